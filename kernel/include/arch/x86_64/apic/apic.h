@@ -32,5 +32,8 @@ void apic_timer_sleep_ms(uint32_t ms);
 void apic_init();
 void apic_timer_simple_test(void);
 void send_eoi_isr(uint8_t vector, int using_apic, int x2apic_enabled);
+int apic_is_x2apic(void);
+uint32_t apic_get_id(void);
+void apic_send_icr(uint32_t dest, uint32_t icr_low);
 
 #endif
\ No newline at end of file
@@ -4,10 +4,35 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include <arch/x86_64/irq.h>
+
+#define IOAPIC_REG_ID       0x00
+#define IOAPIC_REG_VER      0x01
+#define IOAPIC_REDTBL(n)    (0x10 + 2 * (n))
+
+// Redirection entry, low dword
+#define IOAPIC_ACTIVE_LOW   (1 << 13)
+#define IOAPIC_LEVEL        (1 << 15)
+#define IOAPIC_MASKED       (1 << 16)
+
+#define IOAPIC_MAX_GSI      256
+
+// Pass as `cpu` to let the router spread interrupts over online CPUs
+#define IOAPIC_CPU_ANY      (-1)
+
 uint32_t readIOAPIC(size_t ioapicaddr, uint32_t reg);
 void writeIOAPIC(size_t ioapicaddr, uint32_t reg, uint32_t value);
-void enableKeyboard(size_t ioapicaddr);
-void enableSerialCOM1(size_t ioapicaddr);
+void ioapic_init(void);
+int ioapic_route_gsi(uint32_t gsi, uint16_t madt_flags, uint8_t vector, int cpu);
+int ioapic_request_gsi(uint32_t gsi, uint16_t madt_flags, irq_handler_t handler,
+                       void *ctx, uint32_t irqflags, int cpu);
+int ioapic_request_isa_irq(uint8_t irq, irq_handler_t handler, void *ctx, int cpu);
+uint32_t ioapic_isa_to_gsi(uint8_t irq, uint16_t *madt_flags);
+int ioapic_set_affinity(uint32_t gsi, int cpu);
+void ioapic_mask_gsi(uint32_t gsi);
+void ioapic_unmask_gsi(uint32_t gsi);
+void enableKeyboard(void);
+void enableSerialCOM1(void);
 void readIOREDTBLs(size_t ioapicaddr);
 
-#endif
\ No newline at end of file
+#endif
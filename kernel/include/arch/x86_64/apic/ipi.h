@@ -0,0 +1,24 @@
+#ifndef IPI_H
+#define IPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Vectors reserved for inter-processor interrupts
+#define IPI_TLB_SHOOTDOWN_VEC 0xF0
+
+// ICR low dword fields
+#define IPI_DELIVERY_FIXED    (0 << 8)
+#define IPI_DELIVERY_NMI      (4 << 8)
+#define IPI_LEVEL_ASSERT      (1 << 14)
+#define IPI_DEST_NONE         (0 << 18)
+#define IPI_DEST_SELF         (1 << 18)
+#define IPI_DEST_ALL          (2 << 18)
+#define IPI_DEST_ALL_BUT_SELF (3 << 18)
+
+void ipi_send(uint32_t apic_id, uint8_t vector);
+void ipi_send_nmi(uint32_t apic_id);
+void ipi_broadcast(uint8_t vector, bool include_self);
+void ipi_send_mask(uint64_t cpu_mask, uint8_t vector);
+
+#endif // IPI_H
@@ -7,11 +7,68 @@
 
 #include <hardware/devices/io.h>
 
+#include <system/klog.h>
+
 #define fence() __asm__ volatile ("":::"memory")
 
-static uint64_t frequency_tsc_per_sec;
+extern uint64_t frequency_tsc_per_sec;
+
+// Features recorded once by cpu_detect(); query with cpu_has()
+enum CpuFeature {
+    CPU_FEAT_TSC,
+    CPU_FEAT_MSR,
+    CPU_FEAT_APIC,
+    CPU_FEAT_X2APIC,
+    CPU_FEAT_TSC_DEADLINE,
+    CPU_FEAT_INVARIANT_TSC,
+    CPU_FEAT_RDTSCP,
+    CPU_FEAT_PGE,
+    CPU_FEAT_PAT,
+    CPU_FEAT_NX,
+    CPU_FEAT_PAGE1GB,
+    CPU_FEAT_PCID,
+    CPU_FEAT_INVPCID,
+    CPU_FEAT_SSE2,
+    CPU_FEAT_XSAVE,
+    CPU_FEAT_AVX,
+    CPU_FEAT_AVX2,
+    CPU_FEAT_ERMS,
+    CPU_FEAT_FSRM,
+    CPU_FEAT_HYPERVISOR,
+    CPU_FEAT_ARCH_PMU,
+};
+
+typedef struct CpuInfo {
+    char     vendor[13];
+    char     hypervisor[13];    // empty on bare metal
+    uint32_t max_leaf;
+    uint32_t max_ext_leaf;
+    uint32_t family;
+    uint32_t model;
+    uint32_t stepping;
+    uint64_t features;          // 1 << CPU_FEAT_*
+
+    // Architectural PMU, CPUID leaf 0xA
+    uint8_t  pmu_version;
+    uint8_t  pmu_counters;
+    uint8_t  pmu_width;
+    uint8_t  pmu_event_len;     // valid bits in pmu_events_unavailable
+    uint32_t pmu_events_unavailable;
+} CpuInfo;
+
+// Filled before anything else runs and never written again
+extern const CpuInfo* const cpu_info;
+
+void cpu_detect(void);
+void calibrate_tsc(void);
+
+static inline bool cpu_has(enum CpuFeature f)
+{
+    return (cpu_info->features >> f) & 1;
+}
 
 static void hcf(void) {
+    klog_panic();
     for (;;) {
         asm ("hlt");
     }
@@ -26,27 +83,28 @@ static inline bool are_interrupts_enabled()
     return flags & (1 << 9);
 }
 
-static inline uint64_t rdtsc(void)
+// Disable interrupts and return the previous RFLAGS for irq_restore()
+static inline uint64_t irq_save(void)
 {
-    uint32_t low, high;
-    asm volatile("rdtsc":"=a"(low),"=d"(high));
-    return ((uint64_t)high << 32) | low;
+    uint64_t flags;
+    asm volatile ("pushfq\n\t"
+                  "pop %0\n\t"
+                  "cli"
+                  : "=r"(flags) : : "memory");
+    return flags;
 }
 
-static void calibrate_tsc(void)
+static inline void irq_restore(uint64_t flags)
 {
-    const uint32_t delay_ms = 10;
-
-    uint64_t t0 = rdtsc();
-    for (volatile uint64_t i = 0; i < 3000000ULL; i++) {
-        __asm__ volatile("pause");
-    }
-    uint64_t t1 = rdtsc();
-
-    uint64_t delta = t1 - t0;
-    uint64_t freq = (delta * 1000ULL) / delay_ms;
+    if (flags & (1 << 9))
+        asm volatile ("sti" ::: "memory");
+}
 
-    frequency_tsc_per_sec = freq;
+static inline uint64_t rdtsc(void)
+{
+    uint32_t low, high;
+    asm volatile("rdtsc":"=a"(low),"=d"(high));
+    return ((uint64_t)high << 32) | low;
 }
 
 static inline void wrmsr(uint64_t msr, uint64_t value)
@@ -76,6 +134,14 @@ static inline void cpuid(int code, uint32_t* a, uint32_t* d)
     asm volatile ( "cpuid" : "=a"(*a), "=d"(*d) : "0"(code) : "ebx", "ecx" );
 }
 
+static inline void cpuid_count(uint32_t leaf, uint32_t subleaf,
+                               uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d)
+{
+    asm volatile ( "cpuid"
+                   : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                   : "0"(leaf), "2"(subleaf) );
+}
+
 static inline long current_cpu_id(void) {
 	long id;
 	asm volatile ("mov %%gs:24, %%rax" : "=a"(id) : : "memory");
@@ -83,9 +149,7 @@ static inline long current_cpu_id(void) {
 }
 
 static int has_tsc(void) {
-    uint32_t eax = 1, edx = 0;
-    cpuid(1, &eax, &edx);
-    return (edx >> 4) & 1;
+    return cpu_has(CPU_FEAT_TSC);
 }
 
 static void tsc_sleep(uint64_t ms) {
@@ -93,7 +157,15 @@ static void tsc_sleep(uint64_t ms) {
         hcf();
     }
     uint64_t tsc_start = rdtsc();
-    uint64_t tsc_ticks_target = (frequency_tsc_per_sec / 1000) * 10;
+    uint64_t tsc_ticks_target = (frequency_tsc_per_sec / 1000) * ms;
+    while ( (rdtsc() - tsc_start) < tsc_ticks_target ) {
+        __asm__ volatile("pause");
+    }
+}
+
+static inline void tsc_delay_us(uint64_t us) {
+    uint64_t tsc_start = rdtsc();
+    uint64_t tsc_ticks_target = (frequency_tsc_per_sec / 1000000) * us;
     while ( (rdtsc() - tsc_start) < tsc_ticks_target ) {
         __asm__ volatile("pause");
     }
@@ -111,27 +183,13 @@ static void reboot() {
     hcf();
 }
 
+// True under any hypervisor; `vendor_out` (13 bytes) gets its CPUID signature
 static inline bool is_running_under_qemu(char *vendor_out) {
-    uint32_t eax, ebx, ecx, edx;
-    __asm__ volatile (
-        "cpuid"
-        : "=a"(eax), "=c"(ecx)
-        : "a"(1)
-        : "ebx", "edx"
-    );
-    if (!(ecx & (1u << 31)))
+    if (!cpu_has(CPU_FEAT_HYPERVISOR))
         return false;
-
-    __asm__ volatile (
-        "cpuid"
-        : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
-        : "a"(0x40000000)
-    );
     if (vendor_out) {
-        ((uint32_t*)vendor_out)[0] = ebx;
-        ((uint32_t*)vendor_out)[1] = ecx;
-        ((uint32_t*)vendor_out)[2] = edx;
-        vendor_out[12] = 0;
+        for (int i = 0; i < 13; i++)
+            vendor_out[i] = cpu_info->hypervisor[i];
     }
     return true;
 }
@@ -24,5 +24,6 @@ typedef struct IDTPointer
 
 void initIdt();
 void setIdtEntry(IDTEntry *target, uint64_t offset, uint16_t selector, uint8_t ist, uint8_t type_attributes);
+void idt_enable_ist(void);
 
 #endif
\ No newline at end of file
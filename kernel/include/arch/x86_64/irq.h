@@ -0,0 +1,55 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+
+#include <arch/x86_64/isr.h>
+
+#define IRQ_HIST_BUCKETS 16
+
+// irq_request() flags
+#define IRQF_SHARED 0x1     // other handlers may be chained on the vector
+#define IRQF_SYSTEM 0x2     // fixed arch vector (timer, IPIs) outside the device range
+
+typedef void (*irq_handler_t)(InterruptFrame* frame, void* ctx);
+
+typedef struct IrqAction {
+    irq_handler_t handler;
+    void* ctx;
+    const char* name;
+    struct IrqAction* next;
+} IrqAction;
+
+/*
+ * One per vector. irqHandler() calls `handler(frame, ctx)` unconditionally:
+ * unclaimed vectors point at the spurious handler and shared vectors at the
+ * chain walker, so dispatch never branches on the table contents.
+ */
+typedef struct IrqDesc {
+    irq_handler_t handler;
+    void* ctx;
+    uint32_t flags;
+    uint32_t nr_actions;
+    IrqAction action;       // first handler, inline so registration needs no heap
+    IrqAction* chain;       // shared handlers, `action` first
+} __attribute__((aligned(64))) IrqDesc;
+
+/* Per-CPU, per-vector counters, copied out by SYS_IRQ_STATS */
+typedef struct IrqStats {
+    uint64_t count;
+    uint64_t total_cycles;
+    uint64_t max_cycles;
+    uint64_t hist[IRQ_HIST_BUCKETS];   // log2 TSC-cycle buckets, bucket 0 = < 128 cycles
+} IrqStats;
+
+// Pass as `cpu` to irq_get_stats() to sum over all CPUs
+#define IRQ_STATS_ALL_CPUS (-1)
+
+int irq_request(uint8_t vector, irq_handler_t handler, void* ctx, uint32_t flags, const char* name);
+void irq_free(uint8_t vector, irq_handler_t handler, void* ctx);
+const IrqDesc* irq_get_desc(uint8_t vector);
+int irq_get_stats(int cpu, uint8_t vector, IrqStats* out);
+void irq_stats_dump(void);
+void eoi_isr(uint8_t vector);
+
+#endif // IRQ_H
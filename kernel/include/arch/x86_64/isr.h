@@ -4,18 +4,15 @@
 #include <stdint.h>
 
 typedef struct InterruptFrame {
-    // 0  : cr3_saved
-    uint64_t cr3_saved;
-
-    // 8..72 : pushed by pushad, in order (top of stack first)
+    // 0..64 : pushed by pushad, in order (top of stack first)
     uint64_t r11, r10, r9, r8;
     uint64_t rsi, rdi, rdx, rcx, rax;
 
-    // 80, 88 : int_no, err_code
+    // 72, 80 : int_no, err_code
     uint64_t int_no;
     uint64_t err_code;
 
-    // 96.. : CPU-pushed stuff
+    // 88.. : CPU-pushed stuff
     uint64_t rip;
     uint64_t cs;
     uint64_t rflags;
@@ -24,7 +21,7 @@ typedef struct InterruptFrame {
 } __attribute__((packed)) InterruptFrame;
 
 void exceptionHandler(InterruptFrame* frame);
+void paranoidHandler(InterruptFrame* frame, uint64_t rbp);
 void irqHandler(InterruptFrame* frame); 
-void registerInterruptHandler(uint8_t irq, void (*handler) (InterruptFrame*));
 
 #endif
\ No newline at end of file
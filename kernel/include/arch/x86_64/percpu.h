@@ -0,0 +1,57 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MAX_CPUS 16
+
+#define IA32_GS_BASE_MSR        0xC0000101
+#define IA32_KERNEL_GS_BASE_MSR 0xC0000102
+
+// Field offsets used from assembly (interrupts.asm, context_switch.asm,
+// exit_to_thread.asm). Keep in sync with struct PerCpu below.
+#define PERCPU_SELF        0
+#define PERCPU_KERNEL_RSP  8
+#define PERCPU_USER_RSP    16
+#define PERCPU_CPU_ID      24
+#define PERCPU_USER_CS     32
+#define PERCPU_USER_SS     40
+#define PERCPU_LOADED_CR3  48
+
+/*
+ * Per-CPU area reached through GS_BASE while in kernel mode. User GS base
+ * lives in KERNEL_GS_BASE and every kernel entry from ring 3 does swapgs.
+ */
+typedef struct PerCpu {
+    struct PerCpu* self;    // 0:  linear address of this block
+    uint64_t kernel_rsp;    // 8:  top of the current thread's kernel stack
+    uint64_t user_rsp;      // 16: scratch slot for the syscall entry path
+    uint64_t cpu_id;        // 24: read by current_cpu_id()
+    uint64_t user_cs;       // 32: user code selector pushed into syscall frames
+    uint64_t user_ss;       // 40: user data selector pushed into syscall frames
+    uint64_t loaded_cr3;    // 48: address space currently in CR3 (TLB shootdown targeting)
+    uint32_t lapic_id;
+    uint8_t  online;
+
+    volatile uint32_t softirq_pending; // SOFTIRQ_* bits raised by hard IRQs
+    uint32_t in_softirq;               // nonzero while softirq handlers run
+    uint32_t in_irq;                   // nonzero while a hard IRQ, NMI, #DF or #MC handler runs
+    struct Tasklet* tasklets;          // scheduled tasklets, run by SOFTIRQ_TASKLET
+    struct Thread* ksoftirqd;          // takes over when the IRQ-exit budget runs out
+    uint64_t ist_top[3];               // NMI/#DF/#MC stacks, see IST_* in tss.h
+} PerCpu;
+
+extern PerCpu percpu[MAX_CPUS];
+
+static inline PerCpu* this_cpu(void) {
+    PerCpu* p;
+    asm volatile ("mov %%gs:0, %0" : "=r"(p));
+    return p;
+}
+
+void percpu_init_bsp(void);
+void percpu_set_cr3(uint64_t cr3);
+void set_kernel_stack(uint64_t top);
+
+#endif // PERCPU_H
@@ -1,6 +1,9 @@
 #ifndef SYSCALLS_H
 #define SYSCALLS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <arch/x86_64/isr.h>
 
 #define IA32_EFER_MSR 0xC0000080
@@ -9,7 +12,45 @@
 #define IA32_LSTAR_MSR 0xC0000082
 #define IA32_FMASK_MSR 0xC0000084
 
+#define SYS_WRITE         1
+#define SYS_FORK          57
+#define SYS_EXIT          60
+#define SYS_REBOOT        88
+#define SYS_IORING_SETUP  425
+#define SYS_IORING_ENTER  426
+#define SYS_SYSCALL_STATS 500
+#define SYS_IRQ_STATS     501
+#define SYS_PROFILE       502
+#define SYS_GFX_MAP       503
+#define SYS_GFX_DAMAGE    504
+#define SYS_KLOG_READ     505
+
+#define SYSCALL_COUNT        512
+#define SYSCALL_HIST_BUCKETS 16
+
+#define SYSCALL_F_NORETURN   (1u << 0)   // handler never returns to the dispatcher
+
+typedef int64_t (*syscall_fn_t)(struct InterruptFrame* frame, const uint64_t* args);
+
+typedef struct SyscallDesc {
+    const char*  name;
+    syscall_fn_t handler;
+    uint8_t      nargs;
+    uint32_t     flags;
+} SyscallDesc;
+
+/* Per-syscall counters, copied out by SYS_SYSCALL_STATS */
+typedef struct SyscallStats {
+    uint64_t calls;
+    uint64_t total_cycles;
+    uint64_t max_cycles;
+    uint64_t hist[SYSCALL_HIST_BUCKETS];   // log2 TSC-cycle buckets, bucket 0 = < 128 cycles
+} SyscallStats;
+
 void syscall_init(void);
 void syscall_handler(struct InterruptFrame* frame);
+int64_t kernel_write(uint64_t cr3, uint64_t fd, const char* buf, uint64_t len);
+int copy_to_user(uint64_t cr3, void* dst, const void* src, size_t len);
+int copy_from_user(uint64_t cr3, void* dst, const void* src, size_t len);
 
 #endif // SYSCALLS_H
\ No newline at end of file
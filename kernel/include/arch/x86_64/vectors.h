@@ -0,0 +1,25 @@
+#ifndef VECTORS_H
+#define VECTORS_H
+
+#include <stdint.h>
+
+/*
+ * IDT vector layout:
+ *   0x00-0x1F  CPU exceptions
+ *   0x20-0x2F  legacy PIC range (masked once the APIC is up)
+ *   0x40       LAPIC timer (APIC_TIMER_VEC)
+ *   0x50-0xDF  dynamically allocated device vectors (IOAPIC, MSI/MSI-X)
+ *   0x80       int 0x80 syscall gate, reserved inside the device range
+ *   0xF0-0xFE  IPIs (see apic/ipi.h)
+ *   0xFF       LAPIC spurious
+ */
+#define DEVICE_VECTOR_FIRST 0x50
+#define DEVICE_VECTOR_LAST  0xDF
+#define SYSCALL_VECTOR      0x80
+#define SPURIOUS_VECTOR     0xFF
+
+int vector_alloc(void);
+int vector_alloc_range(uint32_t count);
+void vector_free(int vector);
+
+#endif // VECTORS_H
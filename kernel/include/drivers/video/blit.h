@@ -0,0 +1,58 @@
+#ifndef BLIT_H
+#define BLIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Bitmap background that leaves the destination untouched
+#define BLIT_TRANSPARENT 0xFFFFFFFFu
+
+typedef struct DfbRect {
+    uint32_t x, y;
+    uint32_t w, h;
+} DfbRect;
+
+// A 32bpp pixel array; pitch is in bytes and may exceed width * 4
+typedef struct DfbSurface {
+    uint32_t* pixels;
+    uint32_t  width;
+    uint32_t  height;
+    uint32_t  pitch;
+} DfbSurface;
+
+/*
+ * Per-row kernels. blit_init() picks the variant for this CPU; everything
+ * above works a row at a time through this table, so wider kernels can be
+ * dropped in without touching the clipping code.
+ */
+typedef struct BlitRowOps {
+    const char* name;
+    void (*fill)(uint32_t* dst, uint32_t color, size_t count);
+    void (*copy)(uint32_t* dst, const uint32_t* src, size_t count);
+    void (*copy_backward)(uint32_t* dst, const uint32_t* src, size_t count);
+    void (*blend)(uint32_t* dst, const uint32_t* src, size_t count, uint32_t alpha);
+} BlitRowOps;
+
+extern const BlitRowOps* blit_ops;
+
+void blit_init(void);
+
+/*
+ * All operations clip against the surfaces and return the destination
+ * rectangle actually written (w == 0 when nothing was), which is exactly
+ * what a caller needs to report as damage.
+ */
+DfbRect blit_fill(DfbSurface* dst, int32_t x, int32_t y, uint32_t w, uint32_t h, uint32_t color);
+DfbRect blit_copy(DfbSurface* dst, int32_t dx, int32_t dy,
+                  const DfbSurface* src, int32_t sx, int32_t sy, uint32_t w, uint32_t h);
+// Source-over with the source's per-pixel alpha scaled by alpha (0-255)
+DfbRect blit_blend(DfbSurface* dst, int32_t dx, int32_t dy,
+                   const DfbSurface* src, int32_t sx, int32_t sy, uint32_t w, uint32_t h,
+                   uint8_t alpha);
+// 1bpp MSB-first bitmap (font glyphs, cursors), each bit drawn as a scale_x by scale_y block
+DfbRect blit_bitmap(DfbSurface* dst, int32_t dx, int32_t dy,
+                    const uint8_t* bits, uint32_t bw, uint32_t bh, uint32_t stride,
+                    uint32_t scale_x, uint32_t scale_y, uint32_t fg, uint32_t bg);
+
+#endif // BLIT_H
@@ -0,0 +1,43 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <drivers/video/blit.h>
+
+/*
+ * Shared-memory surfaces, one per process. The client draws straight into
+ * its mapping and reports changed rectangles with SYS_GFX_DAMAGE; the
+ * compositor copies only those onto the dfb back buffer and swaps the same
+ * rectangles to the screen. Surfaces are opaque and stacked in creation
+ * order above the console, whose changed rows arrive the same way.
+ * Layout must match user/src/gfx.h.
+ */
+
+#define GFX_SURFACE_USER_ADDR 0x0000000041000000ULL
+#define GFX_MAX_SURFACES      16
+
+#define GFX_ENOMEM 12
+#define GFX_EBUSY  16
+#define GFX_ENODEV 19
+#define GFX_EINVAL 22
+
+struct Process;
+
+typedef struct GfxSurface {
+    struct Process *owner;
+    DfbSurface      pixels;    // kernel (HHDM) view of the shared pages
+    uintptr_t       phys;
+    size_t          pages;
+    int32_t         x, y;      // screen position of the top-left pixel
+    DfbRect         damage;    // pending, in surface coordinates; w == 0 when clean
+} GfxSurface;
+
+void compositor_init(void);
+// Returns the user address of a width * height surface with pitch width * 4
+int64_t gfx_surface_map(struct Process *proc, int64_t x, int64_t y, uint32_t width, uint32_t height);
+int64_t gfx_surface_damage(struct Process *proc, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+void gfx_surface_release(struct Process *proc);
+
+#endif // COMPOSITOR_H
@@ -2,10 +2,34 @@
 #define DEFAULT_FRAMEBUFFER
 
 #include <stdint.h>
+#include <stdbool.h>
 
-void dfb_init(uint32_t width, uint32_t height, uint32_t pitch, void* framebuffer_addr);
+#include <drivers/video/blit.h>
+
+// Damage is kept as at most this many disjoint-ish rectangles
+#define DFB_MAX_DAMAGE 16
+
+bool dfb_init(uint32_t width, uint32_t height, uint32_t pitch, void* framebuffer_addr);
 void dfb_putpixel(uint32_t x, uint32_t y, uint32_t color);
+void dfb_fill_span(uint32_t x, uint32_t y, uint32_t len, uint32_t color);
+void dfb_fill_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color);
 void dfb_fillscreen(uint32_t color);
+
+// Blitter operations into the back buffer, damage included
+void dfb_blit(const DfbSurface* src, int32_t sx, int32_t sy, uint32_t w, uint32_t h, int32_t dx, int32_t dy);
+void dfb_blend(const DfbSurface* src, int32_t sx, int32_t sy, uint32_t w, uint32_t h,
+               int32_t dx, int32_t dy, uint8_t alpha);
+void dfb_draw_bitmap(const uint8_t* bits, uint32_t bw, uint32_t bh, uint32_t stride,
+                     int32_t dx, int32_t dy, uint32_t scale, uint32_t fg, uint32_t bg);
+
+// The back buffer as a blit target; report changes through dfb_damage()
+DfbSurface* dfb_back_surface(void);
+
+// Mark back buffer contents as changed; drawing primitives do this themselves
+void dfb_damage(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+void dfb_damage_all(void);
+
+// Copy only the damaged regions to the front buffer
 void dfb_swapbuffers(void);
 
-#endif // DEFAULT_FRAMEBUFFER
\ No newline at end of file
+#endif // DEFAULT_FRAMEBUFFER
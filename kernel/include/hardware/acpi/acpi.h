@@ -65,6 +65,7 @@ typedef struct GenericAddressStructure
 } __attribute__ ((packed)) GenericAddressStructure;
 
 void acpi_init();
+void *acpi_find_table(const char *signature);
 void acpi_reboot();
 void acpi_shutdown();
 
@@ -0,0 +1,99 @@
+#ifndef MADT_H
+#define MADT_H
+
+#include <stdint.h>
+
+#include <hardware/acpi/acpi.h>
+
+#define MADT_ENTRY_LAPIC            0
+#define MADT_ENTRY_IOAPIC           1
+#define MADT_ENTRY_ISO              2
+#define MADT_ENTRY_NMI_SOURCE       3
+#define MADT_ENTRY_LAPIC_NMI        4
+#define MADT_ENTRY_LAPIC_OVERRIDE   5
+#define MADT_ENTRY_X2APIC           9
+
+// MPS INTI flags used by interrupt source overrides
+#define MADT_POLARITY_MASK          0x3
+#define MADT_POLARITY_CONFORMS      0x0
+#define MADT_POLARITY_HIGH          0x1
+#define MADT_POLARITY_LOW           0x3
+#define MADT_TRIGGER_MASK           0xC
+#define MADT_TRIGGER_CONFORMS       0x0
+#define MADT_TRIGGER_EDGE           0x4
+#define MADT_TRIGGER_LEVEL          0xC
+
+#define MADT_MAX_IOAPICS 8
+#define MADT_MAX_ISOS    16
+#define MADT_MAX_CPUS    64
+
+typedef struct MADT {
+    struct ACPISDTHeader h;
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__ ((packed)) MADT;
+
+typedef struct MADTEntryHeader {
+    uint8_t type;
+    uint8_t length;
+} __attribute__ ((packed)) MADTEntryHeader;
+
+typedef struct MADTLapic {
+    MADTEntryHeader h;
+    uint8_t acpi_processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__ ((packed)) MADTLapic;
+
+typedef struct MADTIoApic {
+    MADTEntryHeader h;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__ ((packed)) MADTIoApic;
+
+typedef struct MADTIso {
+    MADTEntryHeader h;
+    uint8_t bus;
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__ ((packed)) MADTIso;
+
+typedef struct MADTX2Apic {
+    MADTEntryHeader h;
+    uint16_t reserved;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t acpi_processor_uid;
+} __attribute__ ((packed)) MADTX2Apic;
+
+typedef struct MadtIoApicInfo {
+    uint8_t id;
+    uint32_t phys;
+    uint32_t gsi_base;
+} MadtIoApicInfo;
+
+typedef struct MadtIsoInfo {
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} MadtIsoInfo;
+
+typedef struct MadtInfo {
+    uint64_t lapic_phys;
+    uint32_t ioapic_count;
+    MadtIoApicInfo ioapics[MADT_MAX_IOAPICS];
+    uint32_t iso_count;
+    MadtIsoInfo isos[MADT_MAX_ISOS];
+    uint32_t cpu_count;
+    uint32_t cpu_apic_ids[MADT_MAX_CPUS];
+} MadtInfo;
+
+extern MadtInfo madt_info;
+
+int madt_init(void);
+
+#endif // MADT_H
@@ -26,6 +26,11 @@ static inline uint8_t IoRead8(uint16_t port)
     return data;
 }
 
+// Whole buffer to one port with a single rep outsb
+static inline void IoWriteString8(uint16_t port, const void *buf, size_t len)
+{
+    __asm__ volatile ("rep outsb" : "+S"(buf), "+c"(len) : "d"(port) : "memory");
+}
 
 static inline void IoWrite16(uint16_t port, uint16_t data)
 {
@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#include <arch/x86_64/irq.h>
+
 #define PCI_BAR_BASE 0x10
 
 // 2 byte fields
@@ -34,6 +36,21 @@
 #define PCI_CAP_VENDORSPECIFIC 0x9
 #define PCI_CAP_MSIX 0x11
 
+// MSI capability
+#define PCI_MSI_CONTROL 0x2
+#define PCI_MSI_CONTROL_ENABLE 0x1
+#define PCI_MSI_CONTROL_64BIT 0x80
+#define PCI_MSI_ADDRESS 0x4
+
+// MSI-X capability
+#define PCI_MSIX_CONTROL 0x2
+#define PCI_MSIX_CONTROL_MASK 0x4000
+#define PCI_MSIX_CONTROL_ENABLE 0x8000
+#define PCI_MSIX_TABLE 0x4
+#define PCI_MSIX_PBA 0x8
+#define PCI_MSIX_ENTRY_SIZE 16
+#define PCI_MSIX_ENTRY_MASKED 0x1
+
 typedef struct {
 	bool exists;
 	int offset;
@@ -70,7 +87,11 @@ typedef struct pcienum_t {
 			int pbir;
 			uintmax_t pboffset;
 			size_t entrycount;
+			volatile uint32_t *table;
 		} msix;
+		struct {
+			size_t count;
+		} msi;
 	} irq;
 } pcienum_t;
 
@@ -90,6 +111,10 @@ void pci_msixsetmask(pcienum_t *e, int v);
 void pci_msixadd(pcienum_t *e, int msixvec, int vec, int edgetrigger, int deassert);
 size_t pci_initmsi(pcienum_t *e, int requested);
 void pci_msisetbase(pcienum_t *e, int base, int edgetrigger, int deassert);
+void pci_msixadd_cpu(pcienum_t *e, int msixvec, int vec, int cpu, int edgetrigger, int deassert);
+void pci_msisetbase_cpu(pcienum_t *e, int base, int cpu, int edgetrigger, int deassert);
+int pci_msix_request(pcienum_t *e, int msixvec, irq_handler_t handler, void *ctx, int cpu);
+int pci_msi_request(pcienum_t *e, int count, irq_handler_t handler, void *ctx, int cpu);
 void pci_init();
 
 #define PCI_READ32(e, offset) pci_read32(e->bus, e->device, e->function, offset)
@@ -14,9 +14,22 @@
 #include <hardware/memory/paging.h>
 #include <hardware/memory/mmio.h>
 #include <hardware/memory/heap.h>
-#include <hardware/acpi/uacpi/uacpi.h>
-#include <hardware/acpi/uacpi/tables.h>
-#include <hardware/acpi/uacpi/internal/tables.h>
+#include <hardware/acpi/acpi.h>
+
+// One ECAM range from the ACPI MCFG table
+struct acpi_mcfg_allocation {
+	uint64_t address;
+	uint16_t segment;
+	uint8_t start_bus;
+	uint8_t end_bus;
+	uint32_t reserved;
+} __attribute__((packed));
+
+struct acpi_mcfg {
+	ACPISDTHeader hdr;
+	uint64_t reserved;
+	struct acpi_mcfg_allocation entries[];
+} __attribute__((packed));
 
 extern size_t mcfgentrycount;
 extern struct acpi_mcfg_allocation *mcfgentries;
@@ -40,7 +53,7 @@ static void legacy_write32(int bus, int device, int function, uint32_t offset, u
 
 static inline struct acpi_mcfg_allocation *getmcfgentry(int bus) {
 	struct acpi_mcfg_allocation *entry;
-	int i;
+	size_t i;
 
 	for (i = 0; i < mcfgentrycount; ++i) {
 		entry = &mcfgentries[i];
@@ -67,6 +80,8 @@ static uint32_t mcfg_read32(int bus, int device, int function, uint32_t offset)
 
 static void mcfg_write32(int bus, int device, int function, uint32_t offset, uint32_t value) {
 	struct acpi_mcfg_allocation *entry = getmcfgentry(bus);
+	if (entry == NULL)
+		return;
 
 	uint64_t base = (uint64_t)entry->address;
 	volatile uint32_t *address = (uint32_t *)((uintptr_t)base + (((bus - entry->start_bus) << 20) | (device << 15) | (function << 12) | (offset & ~0x3)));
@@ -74,9 +89,10 @@ static void mcfg_write32(int bus, int device, int function, uint32_t offset, uin
 	*address = value;
 }
 
-static uint64_t msiformatmessage(uint32_t *data, int vector, int edgetrigger, int deassert) {
+// the MSI address holds an 8 bit physical destination APIC ID in bits 12..19
+static uint64_t msiformatmessage(uint32_t *data, int vector, int edgetrigger, int deassert, uint32_t apicid) {
 	*data = (edgetrigger ? 0 : (1 << 15)) | (deassert ? 0 : (1 << 14)) | vector;
-	return 0xfee00000 | (current_cpu_id() << 12);
+	return 0xfee00000 | ((apicid & 0xff) << 12);
 }
 
 // in PCIe, every function has 4096 bytes of config space for it.
@@ -6,7 +6,12 @@
 
 #define COM1 0x3F8
 
+#define SERIAL_TX_RING 4096
+#define SERIAL_RX_RING 256
+
 bool initSerial();
+bool serial_enable_irq(void);
+void serial_write(const char* s, size_t len);
 
 bool isSerialReceived();
 char readSerial();
@@ -2,11 +2,19 @@
 #define MMIO_H
 
 
-#define MMIO_WINDOW_BASE 0xffff800000000000UL
+// Sits between the HHDM and the kernel image (0xffffffff80000000)
+#define MMIO_WINDOW_BASE 0xffffffff00000000UL
 
 #include <stdint.h>
 #include <stddef.h>
 
-void *map_mmio_region(uintptr_t phys, size_t size, uint64_t flags);
+typedef enum MmioType {
+    MMIO_UC,    // device registers
+    MMIO_WC,    // linear framebuffers
+    MMIO_WT,
+    MMIO_WB,
+} MmioType;
 
-#endif // MMIO_H
\ No newline at end of file
+void *map_mmio_region(uintptr_t phys, size_t size, MmioType type);
+
+#endif // MMIO_H
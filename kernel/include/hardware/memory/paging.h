@@ -18,7 +18,23 @@
 #define PG_GLOBAL         (1ULL << 8)   /* only PT level */
 #define PG_NX             (1ULL << 63)  /* if EFER.NXE */
 
+#define CR4_PGE           (1ULL << 7)
+
+/*
+ * Memory types as PAT/PCD/PWT index bits of a 4 KiB PTE. Indices 0-3 keep
+ * their power-on meaning; pat_init() puts WC in slot 5.
+ */
+#define IA32_PAT_MSR      0x277
+#define PAT_LAYOUT        0x0007010600070406ULL  /* WB WT UC- UC | WB WC UC- UC */
+
+#define PG_CACHE_WB       0
+#define PG_CACHE_WT       PG_PWT
+#define PG_CACHE_UC       (PG_PCD | PG_PWT)
+#define PG_CACHE_WC       (PG_PAT | PG_PWT)
+#define PG_CACHE_MASK     (PG_PAT | PG_PCD | PG_PWT)
+
 #define PAGE_SIZE 0x1000
+#define USER_ADDR_END 0x0000800000000000ULL   /* first non-canonical-low address */
 
 typedef struct PageEntry {
     uint8_t present : 1;
@@ -52,16 +68,20 @@ extern uint64_t kernel_cr3_phys;
 
 void* getPhysicalAddress(void* virtual_address); 
 PageTable* initPML4(void); 
-void mapPage(void* virtual_address, void* physical_address, uint64_t flags);
-void mapPage_in_pml4(uint64_t pml4_phys, void *virt, void *phys, uint64_t flags);
+void pat_init(void);
+bool mapPage(void* virtual_address, void* physical_address, uint64_t flags);
+bool mapPage_in_pml4(uint64_t pml4_phys, void *virt, void *phys, uint64_t flags);
 void map_region(void *virt, void *phys, size_t size, uint64_t flags);
 uint64_t readCR3(void);
 uintptr_t page_base(void *p);
 void unmapPage(void *virtual_address);
+void unmapPage_in_pml4(uint64_t pml4_phys, void *virt);
+void unmap_region(void *virt, size_t size);
 void page_inc_live(void *block);
 bool page_dec_live_check_empty(void *block);
 uint64_t create_user_address_space(void);
 uint64_t virt_to_phys_in_pml4(uint64_t pml4_phys, void *virt);
+uint64_t user_virt_to_phys(uint64_t pml4_phys, uintptr_t va, bool write);
 
 static inline void* virt_addr(uintptr_t phys) {
     return (void*)(phys + hhdm);
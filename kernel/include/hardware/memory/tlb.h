@@ -0,0 +1,31 @@
+#ifndef TLB_H
+#define TLB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Above this many pages a batch is flushed with a full TLB flush instead
+#define TLB_BATCH_MAX 32
+
+// cr3 value meaning "kernel half": shared by every address space
+#define TLB_KERNEL_CR3 0
+
+/*
+ * Pending invalidations for one address space. Callers add every page they
+ * change and flush once; remote CPUs are only interrupted if they currently
+ * have that CR3 loaded (or always, for kernel-half addresses).
+ */
+typedef struct TlbBatch {
+    uint64_t  cr3;
+    uint32_t  count;
+    bool      full;
+    uintptr_t pages[TLB_BATCH_MAX];
+} TlbBatch;
+
+void tlb_init(void);
+void tlb_batch_init(TlbBatch *batch, uint64_t cr3);
+void tlb_batch_add(TlbBatch *batch, uintptr_t virt);
+void tlb_batch_flush(TlbBatch *batch);
+void tlb_flush_page(uint64_t cr3, uintptr_t virt);
+
+#endif // TLB_H
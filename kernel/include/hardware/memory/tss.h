@@ -23,9 +23,18 @@ struct __attribute__((packed)) Tss {
     uint16_t iomap_base;
 };
 
+// IST slots (1-based, as stored in IDT entries)
+#define IST_DOUBLE_FAULT  1
+#define IST_NMI           2
+#define IST_MACHINE_CHECK 3
+#define IST_COUNT         3
+
+#define IST_STACK_PAGES   4
+
 extern struct Tss tss;
 
 void tss_init();
 void tss_init_gdt(void *tss_entry);
+void tss_set_ist(const uint64_t *tops);
 
 #endif // TSS_H
\ No newline at end of file
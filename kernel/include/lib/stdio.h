@@ -2,7 +2,10 @@
 #define STDIO_H
 
 #include <stdarg.h>
+#include <stddef.h>
 
 int printf(const char *fmt, ...);
+int snprintf(char *buf, size_t size, const char *fmt, ...);
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
 
 #endif
\ No newline at end of file
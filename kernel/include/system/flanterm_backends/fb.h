@@ -61,6 +61,16 @@ struct flanterm_context *flanterm_fb_init(
     size_t margin
 );
 
+/* Point an initialised context at another mapping of the same framebuffer.
+   If shadow (pitch * height bytes of RAM) is given, all drawing and
+   scrolling happens there and changed rows are copied to framebuffer, which
+   is then only ever written: the right thing for WC/UC mappings. */
+void flanterm_fb_set_framebuffer(struct flanterm_context *ctx, uint32_t *framebuffer, uint32_t *shadow);
+/* With a shadow, hand changed rows [y0, y1) to present instead of copying
+   them to the framebuffer; NULL restores the copy. */
+void flanterm_fb_set_present(struct flanterm_context *ctx,
+                             void (*present)(void *arg, size_t y0, size_t y1), void *arg);
+
 #ifdef __cplusplus
 }
 #endif
@@ -66,7 +66,14 @@ struct flanterm_fb_context {
 
     size_t offset_x, offset_y;
 
-    volatile uint32_t *framebuffer;
+    volatile uint32_t *framebuffer;     // drawing target: the shadow when there is one
+
+    // With a shadow, changed pixel rows [dirty_y0, dirty_y1) go to scanout
+    // (or to present) after each flush; scanout is never read.
+    volatile uint32_t *scanout;
+    size_t dirty_y0, dirty_y1;
+    void (*present)(void *arg, size_t y0, size_t y1);
+    void *present_arg;
     size_t pitch;
     size_t width;
     size_t height;
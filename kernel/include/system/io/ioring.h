@@ -0,0 +1,84 @@
+#ifndef IORING_H
+#define IORING_H
+
+#include <stdint.h>
+
+/*
+ * Shared submission/completion rings, one pair per process.
+ * Userspace fills SQEs and bumps sq_tail; the kernel consumes them, posts
+ * CQEs and bumps cq_tail; userspace reaps and bumps cq_head.
+ * Layout must match user/src/ioring.h.
+ */
+
+#define IORING_USER_ADDR     0x0000000040100000ULL
+#define IORING_MAX_ENTRIES   256
+#define IORING_SQES_OFFSET   64
+
+#define IORING_SETUP_SQPOLL  (1u << 0)   // kernel drains the SQ without ioring_enter
+#define IORING_POLL_MS       1
+
+enum {
+    IORING_OP_NOP = 0,
+    IORING_OP_WRITE,
+    IORING_OP_TIMEOUT,
+};
+
+#define IORING_EAGAIN 11
+#define IORING_EFAULT 14
+#define IORING_EBUSY  16
+#define IORING_EINVAL 22
+
+typedef struct IoRingSqe {
+    uint8_t  opcode;
+    uint8_t  flags;
+    uint16_t reserved;
+    int32_t  fd;
+    uint64_t addr;        // WRITE: user buffer
+    uint64_t len;         // WRITE: byte count, TIMEOUT: milliseconds
+    uint64_t user_data;   // echoed back in the CQE
+} IoRingSqe;
+
+typedef struct IoRingCqe {
+    uint64_t user_data;
+    int64_t  res;         // >= 0 on success, -IORING_E* on failure
+} IoRingCqe;
+
+typedef struct IoRingShared {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t sqes_offset;
+    uint32_t cqes_offset;
+    volatile uint32_t cq_overflow;
+} IoRingShared;
+
+struct Process;
+
+/*
+ * The shared page is user-writable, so the kernel only ever reads sq_tail
+ * and cq_head from it. Sizes, masks and the kernel-owned indices live here
+ * and are mirrored out for userspace to read.
+ */
+typedef struct IoRing {
+    struct Process *owner;
+    uint64_t        cr3;
+    IoRingShared   *shared;   // kernel (HHDM) view of the shared pages
+    IoRingSqe      *sqes;
+    IoRingCqe      *cqes;
+    uint32_t        sq_entries;
+    uint32_t        cq_entries;
+    uint32_t        sq_head;
+    uint32_t        cq_tail;
+    volatile uint32_t in_flight;   // issued ops whose CQE is still to come
+    uint32_t        flags;
+    struct IoRing  *next_poll;
+} IoRing;
+
+int64_t ioring_setup(struct Process *proc, uint32_t entries, uint32_t flags);
+int64_t ioring_enter(struct Process *proc, uint32_t to_submit, uint32_t min_complete);
+
+#endif // IORING_H
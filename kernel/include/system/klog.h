@@ -0,0 +1,41 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Syslog-style levels; printf() logs at KLOG_INFO
+enum {
+    KLOG_ERR   = 3,
+    KLOG_WARN  = 4,
+    KLOG_INFO  = 6,
+    KLOG_DEBUG = 7,
+};
+
+#define KLOG_RECORDS  128   // per CPU, power of two
+#define KLOG_TEXT     104   // bytes per record; longer writes span records
+#define KLOG_BATCH    2048  // console write size when draining
+#define KLOG_HISTORY  256   // consumed records kept for SYS_KLOG_READ, power of two
+
+#define KLOG_F_LINE_START 0x1   // record begins a line on its CPU
+
+typedef struct KlogRecord {
+    volatile uint64_t seq;  // slot index + 1 once the record is complete
+    uint64_t tsc;
+    uint16_t len;
+    uint8_t  level;
+    uint8_t  cpu;
+    uint16_t flags;         // KLOG_F_*, set in the history copy
+    uint16_t reserved;
+    char     text[KLOG_TEXT];
+} KlogRecord;
+
+void klog_init(void);
+size_t klog_write(int level, const char *s, size_t len);
+int klog_printf(int level, const char *fmt, ...);
+void klog_set_console_level(int level);
+void klog_flush(void);
+void klog_panic(void);
+size_t klog_read_history(uint64_t *cursor, char *buf, size_t size);
+
+#endif // KLOG_H
@@ -0,0 +1,39 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Lower numbers run first
+enum {
+    SOFTIRQ_TIMER,      // expired timer_register() callbacks
+    SOFTIRQ_SCHED,      // periodic thread-list housekeeping
+    SOFTIRQ_INPUT,      // keyboard scancode processing
+    SOFTIRQ_TASKLET,    // tasklet_schedule() work
+    SOFTIRQ_COMPOSE,    // present damaged client surfaces through dfb
+    SOFTIRQ_CONSOLE,    // klog ring drain to flanterm/serial
+    SOFTIRQ_COUNT
+};
+
+// Work done at IRQ exit before the rest is handed to ksoftirqd
+#define SOFTIRQ_MAX_RESTART 10
+#define SOFTIRQ_MAX_US      2000
+
+typedef void (*softirq_fn_t)(void);
+
+typedef struct Tasklet {
+    struct Tasklet* next;
+    void (*func)(void* data);
+    void* data;
+    volatile int scheduled;
+} Tasklet;
+
+void softirq_init(void);
+void open_softirq(int nr, softirq_fn_t fn);
+void raise_softirq(int nr);
+void softirq_irq_exit(void);
+bool in_softirq(void);
+void tasklet_init(Tasklet* t, void (*func)(void*), void* data);
+void tasklet_schedule(Tasklet* t);
+
+#endif // SOFTIRQ_H
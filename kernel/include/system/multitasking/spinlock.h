@@ -2,6 +2,7 @@
 #define SPINLOCK_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef struct {
 	volatile int locked;
@@ -11,6 +12,11 @@ static inline void spinlock_init(spinlock_t *lock) {
 	lock->locked = 0;
 }
 
+// One attempt, no spinning; true if the lock is now held
+static inline bool spinlock_try_acquire(spinlock_t *lock) {
+	return !(__atomic_fetch_or(&lock->locked, 1, __ATOMIC_ACQUIRE) & 1);
+}
+
 void spinlock_acquire(spinlock_t *lock);
 void spinlock_release(spinlock_t *lock);
 
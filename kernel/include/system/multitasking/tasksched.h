@@ -67,6 +67,9 @@ typedef struct Process {
     uint64_t    pid;
     uint64_t    cr3;           // Address space (shared by all threads)
     
+    struct IoRing *ioring;     // Shared submission/completion rings, if set up
+    struct GfxSurface *surface; // Off-screen surface shown by the compositor, if mapped
+    
     struct Thread *main_thread;
     struct Thread *thread_list;
     int           thread_count;
@@ -82,8 +85,10 @@ void scheduler_init(void);
 Thread *schedule(void);
 Process* create_process(void* elf_data);
 Thread *create_thread(Process* proc, void* user_stack);
+Thread *create_kernel_thread(void (*entry)(void), int priority);
 void finalize_thread_list(void);
 void terminate_process(Process* proc, int exit_code);
+void process_thread_exited(Process* proc);
 void task_trampoline(void);
 
 #endif
\ No newline at end of file
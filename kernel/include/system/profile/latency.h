@@ -0,0 +1,27 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+/*
+ * Accumulate one TSC-cycle measurement into total/max counters and a log2
+ * histogram. Bucket i counts samples of [2^(i+6), 2^(i+7)) cycles; bucket
+ * 0 also takes anything shorter and the last bucket anything longer.
+ * Shared by the IRQ and syscall statistics.
+ */
+static inline void latency_record(uint64_t *total_cycles, uint64_t *max_cycles,
+                                  uint64_t *hist, int buckets, uint64_t cycles)
+{
+    *total_cycles += cycles;
+    if (cycles > *max_cycles)
+        *max_cycles = cycles;
+
+    int bucket = cycles ? 63 - __builtin_clzll(cycles) - 6 : 0;
+    if (bucket < 0)
+        bucket = 0;
+    if (bucket >= buckets)
+        bucket = buckets - 1;
+    hist[bucket]++;
+}
+
+#endif // LATENCY_H
@@ -0,0 +1,50 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <arch/x86_64/isr.h>
+
+#define PROF_STACK_DEPTH 8      // return addresses kept per sample
+#define PROF_RING_PAGES  16     // per-CPU sample ring, oldest samples overwritten
+
+// Where samples come from, picked by profiler_init()
+enum {
+    PROF_SRC_NONE,
+    PROF_SRC_PMU,       // PMC0 overflow delivered as NMI through LVT 0x340
+    PROF_SRC_TIMER,     // LAPIC timer tick, when there is no usable PMU
+};
+
+// profiler_start() events; ignored by the timer source
+enum {
+    PROF_EVENT_CYCLES,          // unhalted core cycles
+    PROF_EVENT_INSTRUCTIONS,    // instructions retired
+};
+
+// SYS_PROFILE operations. There is no privilege model yet, so any process
+// may start, stop or dump the profiler; samples include kernel addresses.
+enum {
+    PROF_OP_START,      // args: event, period (events, or ticks for the timer source)
+    PROF_OP_STOP,
+    PROF_OP_DUMP,       // write every ring to serial
+};
+
+typedef struct ProfSample {
+    uint64_t tsc;
+    uint64_t rip;
+    uint64_t tid;
+    uint32_t cpu;
+    uint16_t depth;             // valid entries in stack[]
+    uint16_t user;              // sampled in ring 3; no stack walk
+    uint64_t stack[PROF_STACK_DEPTH];
+} ProfSample;
+
+void profiler_init(void);
+int profiler_start(int event, uint64_t period);
+void profiler_stop(void);
+void profiler_dump(void);
+bool profiler_nmi(InterruptFrame* frame, uint64_t rbp);
+void profiler_tick(InterruptFrame* frame);
+
+#endif // PROFILER_H
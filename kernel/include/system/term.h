@@ -1,9 +1,17 @@
 #ifndef TERM_H
 #define TERM_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 void term_init();
+void term_map_framebuffer(void);
+void *term_framebuffer(void);
+uint32_t *term_console_pixels(void);
+void term_set_present(void (*present)(void *arg, size_t y0, size_t y1), void *arg);
 void term_writeline(const char *s);
 void term_write(const char *s);
+void term_write_n(const char *s, size_t len);
 void kputchar(char c);
 
 #endif
\ No newline at end of file
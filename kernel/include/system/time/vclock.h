@@ -0,0 +1,29 @@
+#ifndef VCLOCK_H
+#define VCLOCK_H
+
+#include <stdint.h>
+
+/* Read-only clock page mapped into every process (see user/src/vclock.h) */
+#define VCLOCK_USER_ADDR   0x0000000040010000ULL
+#define VCLOCK_VERSION     1
+#define VCLOCK_UPDATE_MS   1000
+
+typedef struct VClockPage {
+    volatile uint32_t seq;      // odd while the kernel is updating the page
+    uint32_t version;
+    uint64_t tsc_base;          // TSC value the bases below were taken at
+    uint64_t mono_base_ns;      // monotonic time at tsc_base
+    uint64_t wall_base_ns;      // nanoseconds since the Unix epoch at tsc_base
+    uint64_t tsc_mult;          // ns = ((tsc - tsc_base) * tsc_mult) >> tsc_shift
+    uint32_t tsc_shift;
+    uint32_t reserved;
+    uint64_t tsc_frequency;
+} VClockPage;
+
+void vclock_init(void);
+void vclock_update(void);
+void vclock_map_into(uint64_t pml4_phys);
+uint64_t vclock_monotonic_ns(void);
+uint64_t vclock_realtime_ns(void);
+
+#endif // VCLOCK_H
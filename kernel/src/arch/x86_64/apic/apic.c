@@ -4,24 +4,46 @@
 #include <arch/x86_64/cpu.h>
 #include <arch/x86_64/apic/apic.h>
 #include <arch/x86_64/pic.h>
+#include <arch/x86_64/irq.h>
 #include <arch/x86_64/isr.h>
-#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/percpu.h>
 
 #include <hardware/memory/paging.h>
 #include <hardware/memory/heap.h>
 #include <hardware/memory/tss.h>
 
+#include <system/multitasking/softirq.h>
 #include <system/multitasking/tasksched.h>
+#include <system/profile/profiler.h>
 
 #define IA32_APIC_BASE_MSR 0x1B
 #define IA32_APIC_BASE_MSR_BSP 0x100 // Processor is a BSP
 #define IA32_APIC_BASE_MSR_ENABLE 0x800
 
+#define IA32_APIC_BASE_MSR_EXTD 0x400 // x2APIC mode
+
 #define APIC_EOI_REGISTER 0xB0
 #define X2APIC_EOI_REGISTER 0x80B
+#define X2APIC_MSR_BASE 0x800
+#define X2APIC_ICR_MSR 0x830
+
+#define APIC_ICR_LOW  0x300
+#define APIC_ICR_HIGH 0x310
+#define APIC_ICR_DELIVERY_PENDING (1 << 12)
 
 #define LAPIC_VIRT  0xFFFFFFFFFEE00000ULL
 
+#define IA32_TSC_DEADLINE_MSR 0x6E0
+
+#define APIC_LVT_TIMER            0x320
+#define APIC_TIMER_INITIAL_COUNT  0x380
+#define APIC_TIMER_CURRENT_COUNT  0x390
+#define APIC_TIMER_DIVIDE         0x3E0
+
+#define APIC_LVT_MASKED           (1 << 16)
+#define APIC_LVT_TIMER_PERIODIC   (1 << 17)
+#define APIC_LVT_TIMER_TSC_DEADLINE (2 << 17)
+
 enum 
 {
     CPUID_FEAT_ECX_SSE3         = 1 << 0, 
@@ -95,9 +117,7 @@ uint8_t apic_init_done = 0;
  
 static int cpuHasMSR()
 {
-    uint32_t eax, edx;
-    cpuid(1, &eax, &edx);
-    return edx & CPUID_FLAG_MSR;
+    return cpu_has(CPU_FEAT_MSR);
 }
  
 void cpuGetMSR(uint32_t msr, uint32_t *lo, uint32_t *hi)
@@ -112,25 +132,45 @@ void cpuSetMSR(uint32_t msr, uint32_t lo, uint32_t hi)
 
 static int getModel(void)
 {
-    uint32_t eax = 0, edx = 0;
-    cpuid(0, &eax, &edx);
-    return eax;
+    return cpu_info->max_leaf;
 }
 
 static int checkAPIC(void)
 {
-    uint32_t eax = 1, edx = 0;
-    cpuid(1, &eax, &edx);
-    return edx & CPUID_FEAT_EDX_APIC;
+    return cpu_has(CPU_FEAT_APIC);
 }
 
+static int checkTSCDeadline(void)
+{
+    return cpu_has(CPU_FEAT_TSC_DEADLINE);
+}
+
+static int checkX2APIC(void)
+{
+    return cpu_has(CPU_FEAT_X2APIC);
+}
+
+static uint8_t x2apic_enabled = 0;
+
+int apic_is_x2apic(void)
+{
+    return x2apic_enabled;
+}
+
+// In x2APIC mode register N of the xAPIC page lives at MSR 0x800 + N/16
 static inline uint32_t lapic_read(uint32_t reg)
 {
+    if (x2apic_enabled)
+        return (uint32_t)rdmsr(X2APIC_MSR_BASE + (reg >> 4));
     return lapic[reg >> 2];
 }
 
 static inline void lapic_write(uint32_t reg, uint32_t val)
 {
+    if (x2apic_enabled) {
+        wrmsr(X2APIC_MSR_BASE + (reg >> 4), val);
+        return;
+    }
     lapic[reg >> 2] = val;
     (void)lapic[0];
 }
@@ -138,32 +178,54 @@ static inline void lapic_write(uint32_t reg, uint32_t val)
 static inline void lapic_send_eoi_mmio(void)
 {
     lapic[LAPIC_EOI >> 2] = 0; 
-    (void)lapic[0];
 }
 
 static inline void lapic_send_eoi_x2apic(void)
 {
-    const uint32_t MSR_X2APIC_EOI = 0x80B;
     uint32_t lo = 0, hi = 0;
-    __asm__ volatile("wrmsr" : : "c"(MSR_X2APIC_EOI), "a"(lo), "d"(hi));
+    __asm__ volatile("wrmsr" : : "c"(X2APIC_EOI_REGISTER), "a"(lo), "d"(hi));
 }
 
 uint32_t readAPICRegister(uint32_t reg)
 {
-    return lapic[reg >> 2];
+    return lapic_read(reg);
 } 
 
 void writeAPICRegister(uint32_t reg, uint32_t value)
 {
-    lapic[reg >> 2] = value;
-    (void)lapic[0];
+    lapic_write(reg, value);
+}
+
+uint32_t apic_get_id(void)
+{
+    if (x2apic_enabled)
+        return lapic_read(LAPIC_ID);
+    return lapic_read(LAPIC_ID) >> 24;
 }
 
-void send_eoi_isr(uint8_t vector, int using_apic, int x2apic_enabled)
+/*
+ * Send an IPI. In x2APIC mode the ICR is a single 64-bit MSR write with a
+ * 32-bit destination; in xAPIC mode the destination goes into ICR high first
+ * and the write to ICR low triggers delivery.
+ */
+void apic_send_icr(uint32_t dest, uint32_t icr_low)
+{
+    if (x2apic_enabled) {
+        wrmsr(X2APIC_ICR_MSR, ((uint64_t)dest << 32) | icr_low);
+        return;
+    }
+
+    while (lapic[APIC_ICR_LOW >> 2] & APIC_ICR_DELIVERY_PENDING)
+        __asm__ volatile("pause");
+    lapic[APIC_ICR_HIGH >> 2] = dest << 24;
+    lapic[APIC_ICR_LOW >> 2] = icr_low;
+}
+
+void send_eoi_isr(uint8_t vector, int using_apic, int x2apic)
 {
     if (using_apic) {
-        if (x2apic_enabled) lapic_send_eoi_x2apic();
-        else                lapic_send_eoi_mmio();
+        if (x2apic) lapic_send_eoi_x2apic();
+        else        lapic_send_eoi_mmio();
         return;
     }
     uint8_t irq = (uint8_t)(vector - 0x20);
@@ -186,11 +248,18 @@ void enableAPIC(void)
     cpuGetMSR(IA32_APIC_BASE_MSR, &lo, &hi);
     uint64_t msr = ((uint64_t)hi << 32) | lo;
 
-    // bit 11 – EN (xAPIC global enable), bit 10 – EXTD (x2APIC) – not touching it
-    msr |= (1ULL << 11);
+    // bit 11 – EN (xAPIC global enable), bit 10 – EXTD (x2APIC).
+    // EN must be set before (or together with) EXTD.
+    msr |= IA32_APIC_BASE_MSR_ENABLE;
+    if (checkX2APIC())
+        msr |= IA32_APIC_BASE_MSR_EXTD;
     lo = (uint32_t)(msr & 0xFFFFFFFF);
     hi = (uint32_t)(msr >> 32);
     cpuSetMSR(IA32_APIC_BASE_MSR, lo, hi);
+
+    x2apic_enabled = (msr & IA32_APIC_BASE_MSR_EXTD) != 0;
+    printf("[ APIC ] %s mode, LAPIC ID %u\n",
+           x2apic_enabled ? "x2APIC" : "xAPIC", apic_get_id());
     uint32_t svr = lapic_read(0xF0);
     svr &= ~0xFF;
     svr |= 0x100 | 0xFF;       // APIC Software Enable + vector 0xFF
@@ -237,13 +306,20 @@ uint64_t timer_now_ms(void) {
     return apic_timer_ticks;
 }
 
+// SOFTIRQ_TIMER handler: callbacks run with interrupts enabled
 void timer_tick(void)
 {
     uint64_t now = apic_timer_ticks;
 
-    while (g_timer_list && g_timer_list->fire_time <= now) {
+    for (;;) {
+        uint64_t flags = irq_save();
         TimerEvent* ev = g_timer_list;
+        if (!ev || ev->fire_time > now) {
+            irq_restore(flags);
+            break;
+        }
         g_timer_list = ev->next;
+        irq_restore(flags);
 
         ev->callback(ev->user_data);
         kfree(ev);
@@ -261,9 +337,11 @@ void timer_register(uint64_t delay_ms, timer_callback_t cb, void* user_data)
     ev->user_data = user_data;
     ev->next      = NULL;
 
+    uint64_t flags = irq_save();
     if (!g_timer_list || fire < g_timer_list->fire_time) {
         ev->next = g_timer_list;
         g_timer_list = ev;
+        irq_restore(flags);
         return;
     }
 
@@ -273,19 +351,92 @@ void timer_register(uint64_t delay_ms, timer_callback_t cb, void* user_data)
     }
     ev->next = cur->next;
     cur->next = ev;
+    irq_restore(flags);
 }
 
 extern int scheduler_running;
 
-static void APIC_timer_callback(InterruptFrame* frame)
+static int apic_timer_tsc_deadline = 0;
+static uint64_t apic_timer_tsc_period = 0;
+static uint64_t apic_timer_next_deadline = 0;
+
+/*
+ * In TSC-deadline mode the timer is one-shot: every expiry arms the next one
+ * an exact period after the previous deadline, so ticks don't drift with
+ * interrupt latency. A deadline that is already in the past is pushed one
+ * period ahead of now instead of firing a burst of catch-up interrupts.
+ */
+static void apic_timer_arm_next_deadline(void)
 {
-    (void)frame;
-    apic_timer_ticks++;
-    timer_tick();
+    uint64_t now = rdtsc();
+
+    apic_timer_next_deadline += apic_timer_tsc_period;
+    if (apic_timer_next_deadline <= now)
+        apic_timer_next_deadline = now + apic_timer_tsc_period;
+
+    wrmsr(IA32_TSC_DEADLINE_MSR, apic_timer_next_deadline);
+}
+
+// SOFTIRQ_SCHED handler: halt once every user thread has finished
+static void sched_softirq(void)
+{
+    if (!scheduler_running)
+        return;
 
-    if (lapic) {
-        writeAPICRegister(APIC_EOI_REGISTER, 0);
+    extern Thread* thread_list;
+    Thread* t = thread_list;
+    int has_ready = 0;
+    int ready_count = 0;
+    int done_count = 0;
+    int safety = 0;
+    
+    if (t) {
+        do {
+            if (t->tid != 0 && t->process) {
+                if (t->state == THREAD_STATE_READY) {
+                    has_ready = 1;
+                    ready_count++;
+                } else if (t->state == THREAD_STATE_DONE) {
+                    done_count++;
+                }
+            }
+            t = t->next;
+            if (++safety > 20) break;
+        } while (t != thread_list);
+    }
+    
+    // Debug: print status every 50 checks (every ~500ms)
+    //static int debug_counter = 0;
+    //if (++debug_counter >= 50) {
+    //    debug_counter = 0;
+    //    printf("[DEBUG] User threads: %d READY, %d DONE\n", ready_count, done_count);
+    //}
+    
+    if (!has_ready && done_count > 0) {
+        printf("\n");
+        printf("==============================================\n");
+        printf("[ KERNEL ] All user threads completed!\n");
+        printf("[ KERNEL ] System halting...\n");
+        printf("==============================================\n");
+        printf("\n");
+        irq_stats_dump();
+        
+        for (volatile int i = 0; i < 10000000; i++);
+        
+        klog_panic();
+        for(;;) __asm__ volatile("cli; hlt");
     }
+}
+
+static void APIC_timer_callback(InterruptFrame* frame, void* ctx)
+{
+    (void)ctx;
+    apic_timer_ticks++;
+    if (apic_timer_tsc_deadline)
+        apic_timer_arm_next_deadline();
+    if (g_timer_list && g_timer_list->fire_time <= apic_timer_ticks)
+        raise_softirq(SOFTIRQ_TIMER);
+    profiler_tick(frame);
 
     if (!scheduler_running) 
         return;
@@ -293,50 +444,14 @@ static void APIC_timer_callback(InterruptFrame* frame)
     static int check_counter = 0;
     if (++check_counter >= 10) {
         check_counter = 0;
-        
-        extern Thread* thread_list;
-        Thread* t = thread_list;
-        int has_ready = 0;
-        int ready_count = 0;
-        int done_count = 0;
-        int safety = 0;
-        
-        if (t) {
-            do {
-                if (t->tid != 0) {
-                    if (t->state == THREAD_STATE_READY) {
-                        has_ready = 1;
-                        ready_count++;
-                    } else if (t->state == THREAD_STATE_DONE) {
-                        done_count++;
-                    }
-                }
-                t = t->next;
-                if (++safety > 20) break;
-            } while (t != thread_list);
-        }
-        
-        // Debug: print status every 50 checks (every ~500ms)
-        //static int debug_counter = 0;
-        //if (++debug_counter >= 50) {
-        //    debug_counter = 0;
-        //    printf("[DEBUG] User threads: %d READY, %d DONE\n", ready_count, done_count);
-        //}
-        
-        if (!has_ready && scheduler_running && done_count > 0) {
-            printf("\n");
-            printf("==============================================\n");
-            printf("[ KERNEL ] All user threads completed!\n");
-            printf("[ KERNEL ] System halting...\n");
-            printf("==============================================\n");
-            printf("\n");
-            
-            for (volatile int i = 0; i < 10000000; i++);
-            
-            for(;;) __asm__ volatile("cli; hlt");
-        }
+        raise_softirq(SOFTIRQ_SCHED);
     }
 
+    // Kernel threads restart from their entry point, so never preempt a
+    // softirq batch midway
+    if (in_softirq())
+        return;
+
     if (current_thread && current_thread->state == THREAD_STATE_DONE) {
         return;
     }
@@ -354,6 +469,10 @@ static void APIC_timer_callback(InterruptFrame* frame)
         current_thread->state == THREAD_STATE_RUNNING) {
         should_switch = 1;
     }
+
+    // e.g. ksoftirqd parking itself
+    if (current_thread && current_thread->state == THREAD_STATE_BLOCKED)
+        should_switch = 1;
     
     if (current_thread && 
         current_thread->state != THREAD_STATE_DONE && 
@@ -365,10 +484,18 @@ static void APIC_timer_callback(InterruptFrame* frame)
         return;
     }
 
+    // A user thread blocked inside a syscall (e.g. ioring_enter waiting for
+    // completions) has no saved kernel context; switch once it is back in
+    // user mode.
+    if (current_thread && current_thread->in_userspace && (frame->cs & 3) == 0) {
+        return;
+    }
+
     Thread *next = schedule();
     if (!next || next == current_thread || next->state == THREAD_STATE_DONE) {
         if (next && next->state == THREAD_STATE_DONE) {
             printf("[ KERNEL ] All threads completed. System halting.\n");
+            klog_panic();
             for(;;) __asm__ volatile("cli; hlt");
         }
         return;
@@ -392,7 +519,7 @@ static void APIC_timer_callback(InterruptFrame* frame)
         next->remaining_time = BASE_TIME_QUANTUM * next->priority;
     }
     
-    tss.rsp0 = (uint64_t)next->kernel_stack_top;
+    set_kernel_stack((uint64_t)next->kernel_stack_top);
     
     extern uint16_t gdt_user_code_selector;
     extern uint16_t gdt_user_data_selector;
@@ -408,7 +535,7 @@ static void APIC_timer_callback(InterruptFrame* frame)
         frame->rflags = next->context.rflags;
         
         if (next->context.cr3) {
-            __asm__ volatile("mov %0, %%cr3" : : "r"(next->context.cr3) : "memory");
+            percpu_set_cr3(next->context.cr3);
         }
     } else {
         
@@ -422,37 +549,63 @@ static void APIC_timer_callback(InterruptFrame* frame)
  
 static int apic_timer_initialized = 0;
 
-void enableAPICTimer(uint32_t dummy)
+void enableAPICTimer(uint32_t frequency)
 {
     if (!checkAPIC()) {
         printf("[ ERROR ] No APIC present!\n");
         return;
     }
 
-    writeAPICRegister(0x3E0, 0xB);
-    writeAPICRegister(0x320, 0xFF);
-    writeAPICRegister(0x380, 0xFFFFFFFF);
+    if (frequency == 0)
+        frequency = 1000;
+
+    open_softirq(SOFTIRQ_TIMER, timer_tick);
+    open_softirq(SOFTIRQ_SCHED, sched_softirq);
+
+    if (checkTSCDeadline() && frequency_tsc_per_sec) {
+        apic_timer_tsc_deadline = 1;
+        apic_timer_tsc_period = frequency_tsc_per_sec / frequency;
+        printf("[ APIC ] TSC-deadline timer, %llu TSC ticks per period\n", apic_timer_tsc_period);
+
+        apic_timer_initialized = 1;
+        irq_request(APIC_TIMER_VEC, &APIC_timer_callback, NULL, IRQF_SYSTEM, "apic-timer");
+        writeAPICRegister(0x80, 0);
+
+        writeAPICRegister(APIC_LVT_TIMER, APIC_TIMER_VEC | APIC_LVT_TIMER_TSC_DEADLINE);
+        // The LVT mode switch must be visible before the deadline is written,
+        // otherwise the MSR write is ignored.
+        __asm__ volatile("mfence" ::: "memory");
+
+        apic_timer_next_deadline = rdtsc() + apic_timer_tsc_period;
+        wrmsr(IA32_TSC_DEADLINE_MSR, apic_timer_next_deadline);
+        return;
+    }
+
+    writeAPICRegister(APIC_TIMER_DIVIDE, 0xB);
+    writeAPICRegister(APIC_LVT_TIMER, APIC_LVT_MASKED);
+    writeAPICRegister(APIC_TIMER_INITIAL_COUNT, 0xFFFFFFFF);
 
     tsc_sleep(10);
 
-    uint32_t current = readAPICRegister(0x390);
+    uint32_t current = readAPICRegister(APIC_TIMER_CURRENT_COUNT);
     
-    uint32_t apic_ticks = 0xFFFFFFFF - current;
+    uint32_t apic_ticks_10ms = 0xFFFFFFFF - current;
+    uint32_t apic_ticks = (uint32_t)(((uint64_t)apic_ticks_10ms * 100) / frequency);
     printf("[ APIC ] Calibrated ticks = %u (0x%x)\n", apic_ticks, apic_ticks);
 
-    if (apic_ticks == 0 || apic_ticks == 0xFFFFFFFF) {
+    if (apic_ticks == 0 || apic_ticks_10ms == 0xFFFFFFFF) {
         printf("[ ERROR ] Invalid calibration!\n");
         return;
     }
 
     apic_timer_initialized = 1;
 
-    registerInterruptHandler(APIC_TIMER_VEC, &APIC_timer_callback);
+    irq_request(APIC_TIMER_VEC, &APIC_timer_callback, NULL, IRQF_SYSTEM, "apic-timer");
     writeAPICRegister(0x80, 0);
 
-    writeAPICRegister(0x320, APIC_TIMER_VEC | 0x20000);
-    writeAPICRegister(0x3E0, 0xB);
-    writeAPICRegister(0x380, apic_ticks);
+    writeAPICRegister(APIC_LVT_TIMER, APIC_TIMER_VEC | APIC_LVT_TIMER_PERIODIC);
+    writeAPICRegister(APIC_TIMER_DIVIDE, 0xB);
+    writeAPICRegister(APIC_TIMER_INITIAL_COUNT, apic_ticks);
 }
 
 // Sleep using APIC timer
@@ -498,7 +651,7 @@ void apic_timer_sleep_microseconds(uint32_t us) {
         apic_timer_sleep_ms(ms);
     }
     if (rem_us > 0) {
-        tsc_sleep(rem_us);
+        tsc_delay_us(rem_us);
     }
 }
 
@@ -532,7 +685,7 @@ void apic_init() {
     uintptr_t apic_phys = apic_msr & 0xFFFFF000ULL;
 
     mapPage((void*)LAPIC_VIRT, (void*)apic_phys,
-            PG_PRESENT | PG_WRITABLE | PG_PWT | PG_PCD);
+            PG_PRESENT | PG_WRITABLE | PG_CACHE_UC);
 
     lapic = (volatile uint32_t*)LAPIC_VIRT;
 
@@ -4,10 +4,19 @@
 
 #include <arch/x86_64/apic/apic.h>
 #include <arch/x86_64/apic/ioapic.h>
+#include <arch/x86_64/irq.h>
 #include <arch/x86_64/isr.h>
 #include <arch/x86_64/pic.h>
+#include <arch/x86_64/percpu.h>
+#include <arch/x86_64/vectors.h>
 
+#include <hardware/acpi/descriptor_tables/madt.h>
+#include <hardware/devices/io.h>
 #include <hardware/devices/serial.h>
+#include <hardware/memory/mmio.h>
+#include <hardware/memory/paging.h>
+#include <system/multitasking/softirq.h>
+#include <system/multitasking/spinlock.h>
 
 extern char* set1_scancodes[];
 extern char* shift_set1_scancodes[];
@@ -26,13 +35,230 @@ void writeIOAPIC(size_t ioapicaddr, uint32_t reg, uint32_t value)
     ioapic[4] = value;
 }
 
+typedef struct IoApic {
+    size_t base;        // mapped register window
+    uint32_t gsi_base;
+    uint32_t count;     // redirection entries
+} IoApic;
+
+typedef struct GsiRoute {
+    uint8_t  vector;    // 0: not routed
+    uint8_t  cpu;
+    uint32_t low;       // redirection low dword without the mask bit
+} GsiRoute;
+
+static IoApic ioapics[MADT_MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+static GsiRoute gsi_routes[IOAPIC_MAX_GSI];
+static spinlock_t ioapic_lock;
+static uint32_t next_cpu = 0;
+
+static IoApic *ioapicForGsi(uint32_t gsi)
+{
+    for (uint32_t i = 0; i < ioapic_count; ++i) {
+        IoApic *io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->count)
+            return io;
+    }
+    return NULL;
+}
+
+void ioapic_init(void)
+{
+    spinlock_init(&ioapic_lock);
+
+    for (uint32_t i = 0; i < madt_info.ioapic_count; ++i) {
+        MadtIoApicInfo *info = &madt_info.ioapics[i];
+        IoApic *io = &ioapics[ioapic_count];
+
+        io->base = (size_t)map_mmio_region(info->phys, 0x20, MMIO_UC);
+        io->gsi_base = info->gsi_base;
+        io->count = ((readIOAPIC(io->base, IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+
+        for (uint32_t pin = 0; pin < io->count; ++pin) {
+            writeIOAPIC(io->base, IOAPIC_REDTBL(pin), IOAPIC_MASKED);
+            writeIOAPIC(io->base, IOAPIC_REDTBL(pin) + 1, 0);
+        }
+
+        printf("[ IOAPIC ] ID %u at %#x, GSIs %u-%u\n", info->id, info->phys,
+               io->gsi_base, io->gsi_base + io->count - 1);
+        ioapic_count++;
+    }
+}
+
+// ISA IRQs are identity mapped to GSIs unless the MADT overrides them
+uint32_t ioapic_isa_to_gsi(uint8_t irq, uint16_t *madt_flags)
+{
+    for (uint32_t i = 0; i < madt_info.iso_count; ++i) {
+        if (madt_info.isos[i].source == irq) {
+            if (madt_flags)
+                *madt_flags = madt_info.isos[i].flags;
+            return madt_info.isos[i].gsi;
+        }
+    }
+    if (madt_flags)
+        *madt_flags = MADT_POLARITY_CONFORMS | MADT_TRIGGER_CONFORMS;
+    return irq;
+}
+
+static int resolveCpu(int cpu)
+{
+    if (cpu == IOAPIC_CPU_ANY) {
+        // Round-robin over online CPUs
+        for (uint32_t tries = 0; tries < MAX_CPUS; ++tries) {
+            uint32_t c = next_cpu++ % MAX_CPUS;
+            if (percpu[c].online)
+                return (int)c;
+        }
+        return 0;
+    }
+    if (cpu < 0 || cpu >= MAX_CPUS || !percpu[cpu].online)
+        return 0;
+    return cpu;
+}
+
+static void writeRoute(IoApic *io, uint32_t gsi, const GsiRoute *r, bool masked)
+{
+    uint32_t pin = gsi - io->gsi_base;
+    // Physical destination mode: an 8-bit APIC ID in bits 56..63. Larger
+    // x2APIC IDs would need interrupt remapping, so fall back to the BSP.
+    uint32_t dest = percpu[r->cpu].lapic_id;
+    if (dest > 0xFF)
+        dest = percpu[0].lapic_id;
+    writeIOAPIC(io->base, IOAPIC_REDTBL(pin), IOAPIC_MASKED);
+    writeIOAPIC(io->base, IOAPIC_REDTBL(pin) + 1, dest << 24);
+    writeIOAPIC(io->base, IOAPIC_REDTBL(pin), r->low | (masked ? IOAPIC_MASKED : 0));
+}
+
+/*
+ * Point a GSI at `vector` on `cpu`. `madt_flags` uses the MPS INTI encoding
+ * from interrupt source overrides; "conforms" means ISA defaults (edge,
+ * active high). Returns 0 or -1 if no IOAPIC owns the GSI.
+ */
+int ioapic_route_gsi(uint32_t gsi, uint16_t madt_flags, uint8_t vector, int cpu)
+{
+    IoApic *io = ioapicForGsi(gsi);
+    if (!io || gsi >= IOAPIC_MAX_GSI) {
+        printf("[ IOAPIC ] No IOAPIC handles GSI %u\n", gsi);
+        return -1;
+    }
+
+    uint32_t low = vector; // fixed delivery, physical destination
+    if ((madt_flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW)
+        low |= IOAPIC_ACTIVE_LOW;
+    if ((madt_flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL)
+        low |= IOAPIC_LEVEL;
+
+    spinlock_acquire(&ioapic_lock);
+    GsiRoute *r = &gsi_routes[gsi];
+    r->vector = vector;
+    r->cpu = (uint8_t)resolveCpu(cpu);
+    r->low = low;
+    writeRoute(io, gsi, r, false);
+    spinlock_release(&ioapic_lock);
+    return 0;
+}
+
+/*
+ * Allocate a vector, install `handler` and route the GSI. With IRQF_SHARED a
+ * GSI that is already routed gets the handler chained on its existing vector.
+ * Returns the vector.
+ */
+int ioapic_request_gsi(uint32_t gsi, uint16_t madt_flags, irq_handler_t handler,
+                       void *ctx, uint32_t irqflags, int cpu)
+{
+    if (gsi < IOAPIC_MAX_GSI && gsi_routes[gsi].vector && (irqflags & IRQF_SHARED)) {
+        int vector = gsi_routes[gsi].vector;
+        if (irq_request((uint8_t)vector, handler, ctx, irqflags, "ioapic") < 0)
+            return -1;
+        return vector;
+    }
+
+    int vector = vector_alloc();
+    if (vector < 0) {
+        printf("[ IOAPIC ] Out of vectors for GSI %u\n", gsi);
+        return -1;
+    }
+    if (irq_request((uint8_t)vector, handler, ctx, irqflags, "ioapic") < 0) {
+        vector_free(vector);
+        return -1;
+    }
+    if (ioapic_route_gsi(gsi, madt_flags, (uint8_t)vector, cpu) < 0) {
+        irq_free((uint8_t)vector, handler, ctx);
+        vector_free(vector);
+        return -1;
+    }
+    return vector;
+}
+
+int ioapic_request_isa_irq(uint8_t irq, irq_handler_t handler, void *ctx, int cpu)
+{
+    uint16_t flags;
+    uint32_t gsi = ioapic_isa_to_gsi(irq, &flags);
+    return ioapic_request_gsi(gsi, flags, handler, ctx, 0, cpu);
+}
+
+int ioapic_set_affinity(uint32_t gsi, int cpu)
+{
+    IoApic *io = ioapicForGsi(gsi);
+    if (!io || gsi >= IOAPIC_MAX_GSI || !gsi_routes[gsi].vector)
+        return -1;
+
+    spinlock_acquire(&ioapic_lock);
+    GsiRoute *r = &gsi_routes[gsi];
+    r->cpu = (uint8_t)resolveCpu(cpu);
+    writeRoute(io, gsi, r, false);
+    spinlock_release(&ioapic_lock);
+    return 0;
+}
+
+static void setMask(uint32_t gsi, bool masked)
+{
+    IoApic *io = ioapicForGsi(gsi);
+    if (!io || gsi >= IOAPIC_MAX_GSI || !gsi_routes[gsi].vector)
+        return;
+    spinlock_acquire(&ioapic_lock);
+    uint32_t pin = gsi - io->gsi_base;
+    writeIOAPIC(io->base, IOAPIC_REDTBL(pin),
+                gsi_routes[gsi].low | (masked ? IOAPIC_MASKED : 0));
+    spinlock_release(&ioapic_lock);
+}
+
+void ioapic_mask_gsi(uint32_t gsi)
+{
+    setMask(gsi, true);
+}
+
+void ioapic_unmask_gsi(uint32_t gsi)
+{
+    setMask(gsi, false);
+}
+
 static bool shift = false;
 static bool caps_lock = false;
 static bool ctrl = false;
 
-static void keyboardHandler(InterruptFrame* frame) 
+// Filled by the IRQ, drained by SOFTIRQ_INPUT; one producer, one consumer
+#define KBD_RING_SIZE 64
+static volatile uint8_t kbd_ring[KBD_RING_SIZE];
+static volatile uint32_t kbd_head = 0;
+static volatile uint32_t kbd_tail = 0;
+
+static void keyboardHandler(InterruptFrame* frame, void* ctx) 
+{
+    (void)frame;
+    (void)ctx;
+    uint8_t input = IoRead8(0x60);
+    uint32_t head = kbd_head;
+    if (head - kbd_tail < KBD_RING_SIZE) {
+        kbd_ring[head % KBD_RING_SIZE] = input;
+        kbd_head = head + 1;
+    }
+    raise_softirq(SOFTIRQ_INPUT);
+}
+
+static void keyboardProcess(size_t input)
 {
-    size_t input = readDataPort();
     if (input == 0x2A || input == 0x36) 
         shift = true;    
 
@@ -58,8 +284,14 @@ static void keyboardHandler(InterruptFrame* frame)
 
     else if (input == 0x9D) 
         ctrl = false;   
-   
-    writeAPICRegister(0xB0, 0);
+}
+
+static void keyboard_softirq(void)
+{
+    while (kbd_tail != kbd_head) {
+        keyboardProcess(kbd_ring[kbd_tail % KBD_RING_SIZE]);
+        kbd_tail++;
+    }
 }
 
 void readIOREDTBLs(size_t ioapicaddr) 
@@ -78,14 +310,17 @@ void readIOREDTBLs(size_t ioapicaddr)
     }
 }
 
-void enableKeyboard(size_t ioapicaddr) 
+void enableKeyboard(void) 
 {
-    writeIOAPIC(ioapicaddr, 0x12, 0x21);
-    registerInterruptHandler(0x21, &keyboardHandler);
+    open_softirq(SOFTIRQ_INPUT, keyboard_softirq);
+    ioapic_request_isa_irq(1, &keyboardHandler, NULL, IOAPIC_CPU_ANY);
 }
 
-void enableSerialCOM1(size_t ioapicaddr)
+// COM1 on ISA IRQ 4, interrupt-driven TX/RX from here on
+void enableSerialCOM1(void)
 {
-    writeIOAPIC(ioapicaddr, 0x18, 0x24);
-    initSerial();
+    if (initSerial())
+        return;
+    if (!serial_enable_irq())
+        printf("[ SERIAL ] IRQ 4 unavailable, staying polled\n");
 }
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <arch/x86_64/apic/apic.h>
+#include <arch/x86_64/apic/ipi.h>
+#include <arch/x86_64/percpu.h>
+
+void ipi_send(uint32_t apic_id, uint8_t vector)
+{
+    apic_send_icr(apic_id, vector | IPI_DELIVERY_FIXED | IPI_LEVEL_ASSERT);
+}
+
+// The vector field is ignored for NMI delivery; the target takes vector 2
+void ipi_send_nmi(uint32_t apic_id)
+{
+    apic_send_icr(apic_id, IPI_DELIVERY_NMI | IPI_LEVEL_ASSERT);
+}
+
+void ipi_broadcast(uint8_t vector, bool include_self)
+{
+    uint32_t shorthand = include_self ? IPI_DEST_ALL : IPI_DEST_ALL_BUT_SELF;
+    apic_send_icr(0, vector | IPI_DELIVERY_FIXED | IPI_LEVEL_ASSERT | shorthand);
+}
+
+// cpu_mask is indexed by PerCpu.cpu_id, not by LAPIC ID
+void ipi_send_mask(uint64_t cpu_mask, uint8_t vector)
+{
+    for (uint32_t cpu = 0; cpu < MAX_CPUS && cpu_mask; ++cpu) {
+        if (!(cpu_mask & (1ULL << cpu)))
+            continue;
+        cpu_mask &= ~(1ULL << cpu);
+        if (percpu[cpu].online)
+            ipi_send(percpu[cpu].lapic_id, vector);
+    }
+}
@@ -5,6 +5,9 @@ extern tss
 extern gdt_user_data_selector
 extern gdt_user_code_selector
 
+%define PERCPU_KERNEL_RSP 8             ; keep in sync with percpu.h
+%define PERCPU_LOADED_CR3 48
+
 section .text
 
 ; ---------------------------------------------------------
@@ -41,6 +44,7 @@ context_switch:
     ; -------- load new context --------
     mov     rax, [rsi + 64]         ; new->cr3
     mov     cr3, rax
+    mov     [gs:PERCPU_LOADED_CR3], rax
 
     mov     rsp, [rsi + 8]          ; new->rsp
     mov     rbp, [rsi + 16]
@@ -89,6 +93,7 @@ enter_userspace_from_task:
     ; Thread.kernel_stack_top at offset 208
     mov     rax, [rdi + 208]
     mov     [rel tss + 4], rax      ; tss.rsp0 is at offset 4
+    mov     [gs:PERCPU_KERNEL_RSP], rax ; syscall entry stack
     
     ; CR3 already loaded by trampoline, don't load again
     
@@ -127,4 +132,5 @@ enter_userspace_from_task:
     xor     r14, r14
     xor     r15, r15
 
+    swapgs                          ; restore user GS base
     iretq
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include <arch/x86_64/cpu.h>
+
+#include <hardware/devices/io.h>
+
+#define PIT_FREQUENCY     1193182ULL
+#define PIT_CHANNEL2      0x42
+#define PIT_COMMAND       0x43
+#define PIT_GATE_PORT     0x61
+
+#define TSC_CALIBRATE_MS  10
+
+uint64_t frequency_tsc_per_sec = 0;
+
+static CpuInfo boot_cpu_info;
+const CpuInfo* const cpu_info = &boot_cpu_info;
+
+static void set_feature(CpuInfo* info, enum CpuFeature f, bool present)
+{
+    if (present)
+        info->features |= 1ULL << f;
+}
+
+static void copy_signature(char* out, uint32_t a, uint32_t b, uint32_t c)
+{
+    ((uint32_t*)out)[0] = a;
+    ((uint32_t*)out)[1] = b;
+    ((uint32_t*)out)[2] = c;
+    out[12] = 0;
+}
+
+/*
+ * Execute CPUID once at boot and keep the answers. Under virtualization every
+ * CPUID is a VM exit, so nothing on a hot path should run it directly.
+ */
+void cpu_detect(void)
+{
+    CpuInfo* info = &boot_cpu_info;
+    uint32_t a, b, c, d;
+
+    cpuid_count(0, 0, &a, &b, &c, &d);
+    info->max_leaf = a;
+    copy_signature(info->vendor, b, d, c);
+
+    cpuid_count(1, 0, &a, &b, &c, &d);
+    info->stepping = a & 0xF;
+    info->model = (a >> 4) & 0xF;
+    info->family = (a >> 8) & 0xF;
+    if (info->family == 0xF)
+        info->family += (a >> 20) & 0xFF;
+    if (info->family >= 0x6)
+        info->model |= ((a >> 16) & 0xF) << 4;
+
+    set_feature(info, CPU_FEAT_TSC,          d & (1u << 4));
+    set_feature(info, CPU_FEAT_MSR,          d & (1u << 5));
+    set_feature(info, CPU_FEAT_APIC,         d & (1u << 9));
+    set_feature(info, CPU_FEAT_PGE,          d & (1u << 13));
+    set_feature(info, CPU_FEAT_PAT,          d & (1u << 16));
+    set_feature(info, CPU_FEAT_SSE2,         d & (1u << 26));
+    set_feature(info, CPU_FEAT_PCID,         c & (1u << 17));
+    set_feature(info, CPU_FEAT_X2APIC,       c & (1u << 21));
+    set_feature(info, CPU_FEAT_TSC_DEADLINE, c & (1u << 24));
+    set_feature(info, CPU_FEAT_XSAVE,        c & (1u << 26));
+    set_feature(info, CPU_FEAT_AVX,          c & (1u << 28));
+    set_feature(info, CPU_FEAT_HYPERVISOR,   c & (1u << 31));
+
+    if (info->max_leaf >= 7) {
+        cpuid_count(7, 0, &a, &b, &c, &d);
+        set_feature(info, CPU_FEAT_AVX2,    b & (1u << 5));
+        set_feature(info, CPU_FEAT_ERMS,    b & (1u << 9));
+        set_feature(info, CPU_FEAT_INVPCID, b & (1u << 10));
+        set_feature(info, CPU_FEAT_FSRM,    d & (1u << 4));
+    }
+
+    if (info->max_leaf >= 0xA) {
+        cpuid_count(0xA, 0, &a, &b, &c, &d);
+        info->pmu_version = a & 0xFF;
+        info->pmu_counters = (a >> 8) & 0xFF;
+        info->pmu_width = (a >> 16) & 0xFF;
+        info->pmu_event_len = (a >> 24) & 0xFF;
+        info->pmu_events_unavailable = b;
+        set_feature(info, CPU_FEAT_ARCH_PMU, info->pmu_version && info->pmu_counters);
+    }
+
+    cpuid_count(0x80000000, 0, &a, &b, &c, &d);
+    info->max_ext_leaf = a;
+    if (info->max_ext_leaf >= 0x80000001) {
+        cpuid_count(0x80000001, 0, &a, &b, &c, &d);
+        set_feature(info, CPU_FEAT_NX,      d & (1u << 20));
+        set_feature(info, CPU_FEAT_PAGE1GB, d & (1u << 26));
+        set_feature(info, CPU_FEAT_RDTSCP,  d & (1u << 27));
+    }
+    if (info->max_ext_leaf >= 0x80000007) {
+        cpuid_count(0x80000007, 0, &a, &b, &c, &d);
+        set_feature(info, CPU_FEAT_INVARIANT_TSC, d & (1u << 8));
+    }
+
+    if (cpu_has(CPU_FEAT_HYPERVISOR)) {
+        cpuid_count(0x40000000, 0, &a, &b, &c, &d);
+        copy_signature(info->hypervisor, b, c, d);
+    }
+
+    printf("[ CPU ] %s family %#x model %#x stepping %u%s%s\n",
+           info->vendor, info->family, info->model, info->stepping,
+           info->hypervisor[0] ? ", hypervisor " : "", info->hypervisor);
+    printf("[ CPU ]%s%s%s%s%s%s%s%s\n",
+           cpu_has(CPU_FEAT_X2APIC) ? " x2apic" : "",
+           cpu_has(CPU_FEAT_TSC_DEADLINE) ? " tsc-deadline" : "",
+           cpu_has(CPU_FEAT_INVARIANT_TSC) ? " invariant-tsc" : "",
+           cpu_has(CPU_FEAT_PCID) ? " pcid" : "",
+           cpu_has(CPU_FEAT_XSAVE) ? " xsave" : "",
+           cpu_has(CPU_FEAT_ERMS) ? " erms" : "",
+           cpu_has(CPU_FEAT_PAT) ? " pat" : "",
+           cpu_has(CPU_FEAT_ARCH_PMU) ? " arch-pmu" : "");
+}
+
+/*
+ * Runs PIT channel 2 in one-shot mode for `ms` milliseconds and counts the
+ * TSC ticks until its output goes high. Returns 0 if the PIT never fires
+ * (no legacy PIT on this machine).
+ */
+static uint64_t pit_measure_tsc(uint32_t ms)
+{
+    uint32_t count = (uint32_t)((PIT_FREQUENCY * ms) / 1000);
+
+    // Gate low, speaker off while the counter is being loaded
+    uint8_t gate = IoRead8(PIT_GATE_PORT);
+    IoWrite8(PIT_GATE_PORT, gate & ~0x03);
+
+    IoWrite8(PIT_COMMAND, 0xB0);            // channel 2, lo/hi byte, mode 0, binary
+    IoWrite8(PIT_CHANNEL2, count & 0xFF);
+    IoWrite8(PIT_CHANNEL2, (count >> 8) & 0xFF);
+
+    // Rising edge on the gate starts the countdown
+    IoWrite8(PIT_GATE_PORT, (gate & ~0x02) | 0x01);
+    uint64_t t0 = rdtsc();
+
+    uint64_t spins = 0;
+    while (!(IoRead8(PIT_GATE_PORT) & 0x20)) {
+        if (++spins > 100000000ULL) {
+            IoWrite8(PIT_GATE_PORT, gate);
+            return 0;
+        }
+    }
+    uint64_t t1 = rdtsc();
+
+    IoWrite8(PIT_GATE_PORT, gate);
+
+    return ((t1 - t0) * 1000ULL) / ms;
+}
+
+/* CPUID leaf 0x16 reports the nominal core frequency in MHz */
+static uint64_t cpuid_tsc_frequency(void)
+{
+    uint32_t a, b, c, d;
+    if (cpu_info->max_leaf < 0x16)
+        return 0;
+
+    cpuid_count(0x16, 0, &a, &b, &c, &d);
+    return (uint64_t)(a & 0xFFFF) * 1000000ULL;
+}
+
+void calibrate_tsc(void)
+{
+    uint64_t freq = pit_measure_tsc(TSC_CALIBRATE_MS);
+    if (!freq)
+        freq = cpuid_tsc_frequency();
+
+    frequency_tsc_per_sec = freq;
+}
@@ -5,6 +5,8 @@ extern gdt_user_code_selector
 extern gdt_kernel_code_selector
 extern gdt_kernel_data_selector
 
+%define PERCPU_LOADED_CR3 48            ; keep in sync with percpu.h
+
 section .text
 
 ; ---------------------------------------------------------
@@ -28,6 +30,7 @@ exit_to_thread:
     test    r8, r8
     jz      .no_cr3
     mov     cr3, r8
+    mov     [gs:PERCPU_LOADED_CR3], r8
 .no_cr3:
     
     movzx   rdx, word [rel gdt_user_data_selector]
@@ -57,6 +60,7 @@ exit_to_thread:
     xor     r14, r14
     xor     r15, r15
     
+    swapgs                          ; restore user GS base
     iretq
 
 .kernel_mode:
@@ -67,6 +71,7 @@ exit_to_thread:
     test    r8, r8
     jz      .no_cr3_kernel
     mov     cr3, r8
+    mov     [gs:PERCPU_LOADED_CR3], r8
 .no_cr3_kernel:
     sti
     jmp     rax ; call trampoline
@@ -1,5 +1,8 @@
 #include <arch/x86_64/idt.h>
 #include <arch/x86_64/isr.h>
+#include <arch/x86_64/vectors.h>
+
+#include <hardware/memory/tss.h>
 
 extern void* isr_stub_table[];
 extern void* irq_stub_table[];
@@ -35,8 +38,20 @@ void initIdt()
     {
         setIdtEntry(&idt_entries[i], (uint64_t)irq_stub_table[i-32], 0x28, 0, 0x8E);
     }
-    setIdtEntry(&idt_entries[0x80], (uint64_t)syscall_entry, 0x28, 0, 0xEE);
+    setIdtEntry(&idt_entries[SYSCALL_VECTOR], (uint64_t)syscall_entry, 0x28, 0, 0xEE);
 
     __asm__ volatile("lidt %0" : : "m"(idt_ptr));
     __asm__ volatile("sti");
+}
+
+/*
+ * Move the vectors that may arrive on a broken stack onto their IST stacks.
+ * Runs once the TSS holding the IST pointers is loaded; before that a
+ * nonzero IST index would itself fault.
+ */
+void idt_enable_ist(void)
+{
+    idt_entries[2].ist = IST_NMI;
+    idt_entries[8].ist = IST_DOUBLE_FAULT;
+    idt_entries[18].ist = IST_MACHINE_CHECK;
 }
\ No newline at end of file
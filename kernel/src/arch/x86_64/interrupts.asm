@@ -1,15 +1,11 @@
 extern exceptionHandler
+extern paranoidHandler
 extern irqHandler
-extern kernel_cr3_phys
 extern syscall_handler
 
-extern tss
-
 global syscall_entry_fast
 global syscall_entry
 
-extern gdt_user_code_selector
-extern gdt_user_data_selector
 
 %macro pushad 0
     push rax      
@@ -35,109 +31,147 @@ extern gdt_user_data_selector
     pop rax
 %endmacro
 
-section .bss
-    align 16
-    temp_user_rsp: resq 1
-    temp_rax:      resq 1
+; PerCpu field offsets, keep in sync with include/arch/x86_64/percpu.h
+%define PERCPU_KERNEL_RSP 8
+%define PERCPU_USER_RSP   16
+%define PERCPU_USER_CS    32
+%define PERCPU_USER_SS    40
+
+%define IA32_GS_BASE_MSR  0xC0000101
+
+; swapgs on kernel entry/exit only when the interrupted context was ring 3.
+; %1 is the offset of the saved CS relative to rsp at the point of use.
+%macro swapgs_if_user 1
+    test qword [rsp + %1], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
+
 section .text
 
 syscall_entry_fast:
     ; On entry: RCX=RIP, R11=RFLAGS, RSP=UserStack, RAX=SyscallNum
-    
-    mov [rel temp_user_rsp], rsp
-    mov [rel temp_rax], rax ; Save original RAX (syscall number)
-
-    mov rsp, [rel tss + 4] ; load kernel stack from TSS
-    
-    xor rax, rax
-    mov ax, [rel gdt_user_data_selector] ; Load User Data Selector
-    push rax 
-    
-    push qword [rel temp_user_rsp] ; Push User RSP
-    
-    push r11 ; Push RFLAGS (from R11)    
-    
-    xor rax, rax
-    mov ax, [rel gdt_user_code_selector] ; Load User Code Selector
-    push rax       
-    
-    push rcx ; Push User RIP
+    ; Interrupts are masked by FMASK until we iretq.
+    swapgs
+    mov [gs:PERCPU_USER_RSP], rsp
+    mov rsp, [gs:PERCPU_KERNEL_RSP]
+
+    ; Build the same frame the int 0x80 path produces so syscall_handler
+    ; and the scheduler can treat both uniformly.
+    push qword [gs:PERCPU_USER_SS]  ; SS
+    push qword [gs:PERCPU_USER_RSP] ; RSP
+    push r11                        ; RFLAGS
+    push qword [gs:PERCPU_USER_CS]  ; CS
+    push rcx                        ; RIP
 
     push qword 0          ; Err code
     push qword 0x80       ; Int no
 
-    push qword [rel temp_rax] 
-    
-    push rcx
-    push rdx
-    push rdi
-    push rsi
-    push r8
-    push r9
-    push r10
-    push r11
-    push qword 0          ; cr3 placeholder
-
-    mov rax, cr3
-    mov [rsp], rax        ; Save old CR3
-    mov rax, [rel kernel_cr3_phys]
-    mov cr3, rax
+    ; Only caller-saved registers; the C handler preserves the rest.
+    pushad
 
+    ; The kernel half is shared by every address space, so the handler
+    ; runs on the caller's CR3.
     mov rdi, rsp
     cld
     call syscall_handler
 
-    mov rax, [rsp]
-    mov cr3, rax
+    ; Return with sysretq unless the frame was redirected somewhere sysret
+    ; cannot go. sysret takes CS/SS from STAR, so the frame must still hold
+    ; the user code selector, and a non-canonical RCX would #GP in ring 0
+    ; on the user stack, so RIP must lie in the lower canonical half.
+    mov rcx, [rsp + 96]   ; frame CS
+    cmp rcx, [gs:PERCPU_USER_CS]
+    jne .iret_return
+    mov rcx, [rsp + 88]   ; frame RIP
+    shr rcx, 47
+    jnz .iret_return
 
-    add rsp, 8            ; Skip CR3
-    pop r11
-    pop r10
-    pop r9
-    pop r8
-    pop rsi
-    pop rdi
-    pop rdx
-    pop rcx
-    pop rax
-    
+    popad
+    add rsp, 16           ; Skip IntNo, ErrCode
+    mov rcx, [rsp]        ; RIP
+    mov r11, [rsp + 16]   ; RFLAGS
+    mov rsp, [rsp + 24]   ; user RSP, IF is still clear from FMASK
+    swapgs
+    o64 sysret
+
+.iret_return:
+    popad
     add rsp, 16           ; Skip IntNo, ErrCode
 
     ; The stack now contains exactly [RIP, CS, RFLAGS, RSP, SS]
+    swapgs
     iretq
 
 syscall_entry:
-    push 0x80
     push 0
+    push 0x80
+    swapgs_if_user 24
     pushad
-    mov rdi, cr3
-    push rdi
-    mov rdi, [rel kernel_cr3_phys]
-    mov cr3, rdi
     cld
-    lea rdi, [rsp]
+    mov rdi, rsp
     call syscall_handler
-    pop rdi
-    mov cr3, rdi
     popad
+    swapgs_if_user 24
     add rsp, 16
     iretq
 
 isr_common_stub:
+    swapgs_if_user 24
     pushad
-    mov rdi, cr3
-    push rdi
-    mov rdi, [rel kernel_cr3_phys]
-    mov cr3, rdi
     cld 
-    lea rdi, [rsp]
+    mov rdi, rsp
     call exceptionHandler
-    pop rdi
-    mov cr3, rdi
     popad
+    swapgs_if_user 24
     add rsp, 0x10 
     iretq
 
+; NMI, #DF and #MC run on IST stacks and can interrupt kernel code between
+; a ring transition and its swapgs, so the saved CS says nothing about which
+; GS base is live. Ask the MSR instead: the per-CPU area sits in the upper
+; half, a user GS base never does. rbx (callee-saved) remembers the decision.
+; The interrupted rbp goes to the handler for the profiler's stack walk.
+isr_paranoid_stub:
+    pushad
+    push rbx
+    push rbp              ; also keeps the call 16-byte aligned
+    xor ebx, ebx
+    mov ecx, IA32_GS_BASE_MSR
+    rdmsr
+    test edx, edx
+    js .gs_kernel
+    swapgs
+    mov ebx, 1
+.gs_kernel:
+    cld
+    lea rdi, [rsp + 16]
+    mov rsi, rbp
+    call paranoidHandler
+    test ebx, ebx
+    jz .gs_restored
+    swapgs
+.gs_restored:
+    pop rbp
+    pop rbx
+    popad
+    add rsp, 0x10
+    iretq
+
+%macro isr_paranoid_err_stub 1
+isr_stub_%+%1:
+    push %1
+    jmp isr_paranoid_stub
+%endmacro
+
+%macro isr_paranoid_no_err_stub 1
+isr_stub_%+%1:
+    push 0
+    push %1
+    jmp isr_paranoid_stub
+%endmacro
+
 %macro isr_err_stub 1
 isr_stub_%+%1:
     push %1
@@ -153,13 +187,13 @@ isr_stub_%+%1:
 
 isr_no_err_stub 0
 isr_no_err_stub 1
-isr_no_err_stub 2
+isr_paranoid_no_err_stub 2
 isr_no_err_stub 3
 isr_no_err_stub 4
 isr_no_err_stub 5
 isr_no_err_stub 6
 isr_no_err_stub 7
-isr_err_stub    8
+isr_paranoid_err_stub 8
 isr_no_err_stub 9
 isr_err_stub    10
 isr_err_stub    11
@@ -169,7 +203,7 @@ isr_err_stub    14
 isr_no_err_stub 15
 isr_no_err_stub 16
 isr_err_stub    17
-isr_no_err_stub 18
+isr_paranoid_no_err_stub 18
 isr_no_err_stub 19
 isr_no_err_stub 20
 isr_no_err_stub 21
@@ -185,17 +219,13 @@ isr_err_stub    30
 isr_no_err_stub 31
 
 irq_common_stub:
+    swapgs_if_user 24
     pushad
-    mov rdi, cr3
-    push rdi
-    mov rdi, [rel kernel_cr3_phys]
-    mov cr3, rdi
     cld
-    lea rdi, [rsp]
+    mov rdi, rsp
     call irqHandler
-    pop rdi
-    mov cr3, rdi
     popad
+    swapgs_if_user 24
     add rsp, 0x10
     iretq
 
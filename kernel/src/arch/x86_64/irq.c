@@ -0,0 +1,244 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arch/x86_64/apic/apic.h>
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/irq.h>
+#include <arch/x86_64/percpu.h>
+#include <arch/x86_64/pic.h>
+#include <arch/x86_64/vectors.h>
+
+#include <hardware/memory/heap.h>
+
+#include <system/multitasking/softirq.h>
+#include <system/multitasking/spinlock.h>
+#include <system/profile/latency.h>
+
+extern char _text_start[];
+extern char _text_end[];
+
+static void irq_spurious(InterruptFrame* frame, void* ctx)
+{
+    (void)frame;
+    (void)ctx;
+}
+
+static IrqDesc irq_desc[256] = {
+    [0 ... 255] = { .handler = irq_spurious },
+};
+static spinlock_t irq_lock;
+
+// Indexed by cpu_id so each CPU only ever writes its own lines
+static IrqStats irq_stats[MAX_CPUS][256];
+
+static void irq_shared_dispatch(InterruptFrame* frame, void* ctx)
+{
+    IrqDesc* desc = ctx;
+    for (IrqAction* a = desc->chain; a; a = a->next)
+        a->handler(frame, a->ctx);
+}
+
+// Point the dispatch pair at whatever the chain now holds
+static void irq_publish(IrqDesc* desc)
+{
+    if (desc->nr_actions == 0) {
+        desc->handler = irq_spurious;
+        desc->ctx = NULL;
+    } else if (desc->nr_actions == 1) {
+        desc->handler = desc->action.handler;
+        desc->ctx = desc->action.ctx;
+    } else {
+        desc->handler = irq_shared_dispatch;
+        desc->ctx = desc;
+    }
+}
+
+/*
+ * Install `handler` on `vector`. All checks happen here so the dispatch path
+ * can trust the table. Returns 0, or -1 if the handler is outside kernel text,
+ * the vector is an exception or a fixed gate, lies outside the device range
+ * without IRQF_SYSTEM, or is taken and not shareable.
+ */
+int irq_request(uint8_t vector, irq_handler_t handler, void* ctx, uint32_t flags, const char* name)
+{
+    if (vector < 32) {
+        printf("[ IRQ ] Vector %u is reserved for exceptions\n", vector);
+        return -1;
+    }
+    if (vector == SYSCALL_VECTOR || vector == SPURIOUS_VECTOR) {
+        printf("[ IRQ ] Vector %#x is a fixed system gate\n", vector);
+        return -1;
+    }
+    if (!(flags & IRQF_SYSTEM) && (vector < DEVICE_VECTOR_FIRST || vector > DEVICE_VECTOR_LAST)) {
+        printf("[ IRQ ] Vector %#x is outside the device range\n", vector);
+        return -1;
+    }
+    if ((char*)handler < _text_start || (char*)handler >= _text_end) {
+        printf("[ IRQ ] Rejecting handler %p for vector %u: not kernel text\n", handler, vector);
+        return -1;
+    }
+
+    IrqDesc* desc = &irq_desc[vector];
+    IrqAction* extra = NULL;
+
+    // Allocate outside the lock; the heap may take its own
+    if (desc->nr_actions)
+        extra = kmalloc(sizeof(IrqAction));
+
+    uint64_t irqflags = irq_save();
+    spinlock_acquire(&irq_lock);
+
+    if (desc->nr_actions && !(desc->flags & flags & IRQF_SHARED)) {
+        spinlock_release(&irq_lock);
+        irq_restore(irqflags);
+        kfree(extra);
+        printf("[ IRQ ] Vector %u busy (%s)\n", vector, desc->action.name);
+        return -1;
+    }
+
+    IrqAction* a = &desc->action;
+    if (desc->nr_actions) {
+        if (!extra) {
+            spinlock_release(&irq_lock);
+            irq_restore(irqflags);
+            return -1;
+        }
+        a = extra;
+        IrqAction* tail = desc->chain;
+        while (tail->next)
+            tail = tail->next;
+        tail->next = a;
+    } else {
+        desc->chain = a;
+        desc->flags = flags;
+    }
+
+    a->handler = handler;
+    a->ctx = ctx;
+    a->name = name;
+    a->next = NULL;
+    desc->nr_actions++;
+    irq_publish(desc);
+
+    spinlock_release(&irq_lock);
+    irq_restore(irqflags);
+    return 0;
+}
+
+void irq_free(uint8_t vector, irq_handler_t handler, void* ctx)
+{
+    IrqDesc* desc = &irq_desc[vector];
+    IrqAction* unused = NULL;
+
+    uint64_t irqflags = irq_save();
+    spinlock_acquire(&irq_lock);
+
+    IrqAction** link = &desc->chain;
+    while (*link && ((*link)->handler != handler || (*link)->ctx != ctx))
+        link = &(*link)->next;
+
+    IrqAction* a = *link;
+    if (a) {
+        if (a == &desc->action && a->next) {
+            // Keep the inline slot occupied: pull the next action into it
+            unused = a->next;
+            desc->action = *unused;
+        } else if (a == &desc->action) {
+            desc->chain = NULL;
+        } else {
+            *link = a->next;
+            unused = a;
+        }
+        desc->nr_actions--;
+        if (!desc->nr_actions)
+            desc->flags = 0;
+        irq_publish(desc);
+    }
+
+    spinlock_release(&irq_lock);
+    irq_restore(irqflags);
+    kfree(unused);
+}
+
+const IrqDesc* irq_get_desc(uint8_t vector)
+{
+    return &irq_desc[vector];
+}
+
+int irq_get_stats(int cpu, uint8_t vector, IrqStats* out)
+{
+    if (cpu != IRQ_STATS_ALL_CPUS && (cpu < 0 || cpu >= MAX_CPUS))
+        return -1;
+    if (cpu != IRQ_STATS_ALL_CPUS) {
+        *out = irq_stats[cpu][vector];
+        return 0;
+    }
+
+    memset(out, 0, sizeof(*out));
+    for (int c = 0; c < MAX_CPUS; c++) {
+        const IrqStats* st = &irq_stats[c][vector];
+        out->count += st->count;
+        out->total_cycles += st->total_cycles;
+        if (st->max_cycles > out->max_cycles)
+            out->max_cycles = st->max_cycles;
+        for (int b = 0; b < IRQ_HIST_BUCKETS; b++)
+            out->hist[b] += st->hist[b];
+    }
+    return 0;
+}
+
+// Console dump of every vector that has fired, one line per CPU
+void irq_stats_dump(void)
+{
+    printf("[ IRQ ] vec cpu      count   avg cyc   max cyc  handler\n");
+    for (int v = 32; v < 256; v++) {
+        for (int c = 0; c < MAX_CPUS; c++) {
+            const IrqStats* st = &irq_stats[c][v];
+            if (!st->count)
+                continue;
+            const char* name = irq_desc[v].nr_actions ? irq_desc[v].action.name : "spurious";
+            printf("[ IRQ ] %#4x %3d %10llu %9llu %9llu  %s\n", v, c, st->count,
+                   st->total_cycles / st->count, st->max_cycles, name ? name : "?");
+        }
+    }
+}
+
+static inline void irq_record(IrqStats* st, uint64_t cycles)
+{
+    st->count++;
+    latency_record(&st->total_cycles, &st->max_cycles, st->hist, IRQ_HIST_BUCKETS, cycles);
+}
+
+extern uint8_t apic_init_done;
+
+void eoi_isr(uint8_t vector) {
+    if (apic_init_done) {
+        send_eoi_isr(vector, 1, apic_is_x2apic());
+    } else {
+        sendEOIPIC(vector);
+    }
+}
+
+void irqHandler(InterruptFrame* frame) {
+    uint8_t vec = frame->int_no;
+    IrqDesc* desc = &irq_desc[vec];
+
+    // The timer ticks before percpu_init_bsp(); only the BSP runs until then
+    bool online = percpu[0].online;
+    uint32_t cpu = online ? current_cpu_id() : 0;
+
+    if (online)
+        this_cpu()->in_irq++;
+
+    // Handler time only; the softirq work it raises is accounted separately
+    uint64_t start = rdtsc();
+    desc->handler(frame, desc->ctx);
+    irq_record(&irq_stats[cpu][vec], rdtsc() - start);
+
+    eoi_isr(vec);
+    if (online)
+        this_cpu()->in_irq--;
+    softirq_irq_exit();
+}
@@ -1,9 +1,11 @@
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #include <arch/x86_64/isr.h>
 #include <arch/x86_64/cpu.h>
+#include <arch/x86_64/percpu.h>
 #include <arch/x86_64/pic.h>
 #include <arch/x86_64/apic/apic.h>
 #include <arch/x86_64/pic.h>
@@ -13,8 +15,8 @@
 #include <system/flanterm.h>
 #include <system/flanterm_backends/fb.h>
 #include <system/multitasking/tasksched.h>
+#include <system/profile/profiler.h>
 
-void (*interrupt_handlers[256]) (InterruptFrame* frame);
 
 extern void context_switch(Thread* old_thread, Thread* new_thread);
 
@@ -45,7 +47,7 @@ static void showRegisters(InterruptFrame* frame) {
 extern Thread* current_thread;
 
 void exceptionHandler(InterruptFrame* frame) {
-    if (current_thread && current_thread->process->pid != 0) {
+    if (current_thread && current_thread->process && current_thread->process->pid != 0) {
         printf("\n=== PROCESS EXCEPTION ===\n");
         printf("Process PID: %llu, Thread TID: %llu\n", 
                current_thread->process->pid, current_thread->tid);
@@ -175,31 +177,16 @@ void exceptionHandler(InterruptFrame* frame) {
     hcf();
 }
 
-void registerInterruptHandler(uint8_t interrupt, void (*handler) (InterruptFrame* frame))
-{
-    interrupt_handlers[interrupt] = handler;
-}
+// NMI, #DF and #MC entry (IST stack); `rbp` is the interrupted frame pointer
+void paranoidHandler(InterruptFrame* frame, uint64_t rbp) {
+    // The stub has already switched to the kernel GS
+    bool online = percpu[0].online;
+    if (online)
+        this_cpu()->in_irq++;
 
-extern uint8_t apic_init_done;
+    if (!(frame->int_no == 2 && profiler_nmi(frame, rbp)))
+        exceptionHandler(frame);
 
-void eoi_isr(uint8_t vector) {
-    if (apic_init_done) {
-        send_eoi_isr(vector, 1, 0);
-    } else {
-        sendEOIPIC(vector);
-    }
+    if (online)
+        this_cpu()->in_irq--;
 }
-
-void irqHandler(InterruptFrame* frame) {
-    uint8_t vec = frame->int_no;
-
-    //if (vec != 0xFE && vec != 0x40) {
-    //    printf("[IRQ] Received IRQ vector: %u (CS=%#lx, RIP=%#lx)\\n", 
-    //           vec, frame->cs, frame->rip);
-    //}
-
-    if (interrupt_handlers[vec] != NULL && is_mapped((void*)interrupt_handlers[vec])) {
-        interrupt_handlers[vec](frame);
-    }
-    eoi_isr(vec);
-}
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/idt.h>
+#include <arch/x86_64/percpu.h>
+
+#include <hardware/memory/gdt.h>
+#include <hardware/memory/paging.h>
+#include <hardware/memory/pmm.h>
+#include <hardware/memory/tss.h>
+
+_Static_assert(offsetof(PerCpu, self) == PERCPU_SELF, "PerCpu.self offset");
+_Static_assert(offsetof(PerCpu, kernel_rsp) == PERCPU_KERNEL_RSP, "PerCpu.kernel_rsp offset");
+_Static_assert(offsetof(PerCpu, user_rsp) == PERCPU_USER_RSP, "PerCpu.user_rsp offset");
+_Static_assert(offsetof(PerCpu, cpu_id) == PERCPU_CPU_ID, "PerCpu.cpu_id offset");
+_Static_assert(offsetof(PerCpu, user_cs) == PERCPU_USER_CS, "PerCpu.user_cs offset");
+_Static_assert(offsetof(PerCpu, user_ss) == PERCPU_USER_SS, "PerCpu.user_ss offset");
+_Static_assert(offsetof(PerCpu, loaded_cr3) == PERCPU_LOADED_CR3, "PerCpu.loaded_cr3 offset");
+
+PerCpu percpu[MAX_CPUS] __attribute__((aligned(64)));
+
+_Static_assert(sizeof(((PerCpu*)0)->ist_top) / sizeof(uint64_t) == IST_COUNT, "PerCpu.ist_top size");
+
+// NMI, #DF and #MC each get a private stack so they never run on the interrupted one
+static void percpu_alloc_ist(PerCpu* cpu) {
+    for (int i = 0; i < IST_COUNT; i++) {
+        uintptr_t phys = alloc_pages(IST_STACK_PAGES);
+        if (!phys) {
+            printf("[ PERCPU ] Out of memory for IST stack %d of CPU %llu\n", i + 1, cpu->cpu_id);
+            hcf();
+        }
+        cpu->ist_top[i] = phys + hhdm + IST_STACK_PAGES * PAGE_SIZE;
+    }
+}
+
+// Must run after gdt_init_from_limine(): reloading GS there zeroes GS_BASE.
+void percpu_init_bsp(void) {
+    PerCpu* cpu = &percpu[0];
+
+    cpu->self = cpu;
+    cpu->cpu_id = 0;
+    cpu->kernel_rsp = tss.rsp0;
+    cpu->user_cs = gdt_user_code_selector;
+    cpu->user_ss = gdt_user_data_selector;
+    cpu->loaded_cr3 = readCR3() & ~0xFFFULL;
+
+    uint32_t eax, ebx, ecx, edx;
+    cpuid_count(1, 0, &eax, &ebx, &ecx, &edx);
+    cpu->lapic_id = ebx >> 24;
+
+    wrmsr(IA32_GS_BASE_MSR, (uint64_t)cpu);
+    wrmsr(IA32_KERNEL_GS_BASE_MSR, 0);
+
+    percpu_alloc_ist(cpu);
+    tss_set_ist(cpu->ist_top);
+    idt_enable_ist();
+
+    cpu->online = 1;
+
+    printf("[ PERCPU ] CPU%llu area at %p (LAPIC ID %u)\n",
+           cpu->cpu_id, cpu, cpu->lapic_id);
+}
+
+// The CPU takes RSP from tss.rsp0 on ring 3 interrupts and the syscall
+// entry takes it from the per-CPU area; both must follow the running thread.
+void set_kernel_stack(uint64_t top) {
+    tss.rsp0 = top;
+    this_cpu()->kernel_rsp = top;
+}
+
+// Load a new address space and record it for TLB shootdown targeting
+void percpu_set_cr3(uint64_t cr3) {
+    __asm__ volatile ("mov %0, %%cr3" :: "r"(cr3) : "memory");
+    this_cpu()->loaded_cr3 = cr3;
+}
@@ -2,20 +2,27 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <arch/x86_64/syscalls.h>
+#include <arch/x86_64/irq.h>
 #include <arch/x86_64/isr.h>
 #include <arch/x86_64/cpu.h>
+#include <arch/x86_64/percpu.h>
 
 #include <hardware/memory/gdt.h>
 #include <hardware/memory/paging.h>
 #include <hardware/memory/tss.h>
 
+#include <drivers/video/compositor.h>
+
+#include <system/klog.h>
 #include <system/term.h>
+#include <system/io/ioring.h>
 #include <system/multitasking/spinlock.h>
 #include <system/multitasking/tasksched.h>
-
-#define SYSCALL_COUNT 1024
+#include <system/profile/latency.h>
+#include <system/profile/profiler.h>
 
 extern uint16_t gdt_kernel_code_selector;
 extern uint16_t gdt_user_data_selector;
@@ -24,30 +31,114 @@ extern void context_switch(ThreadContext *old, ThreadContext *new);
 extern Thread* current_thread;
 extern uintptr_t hhdm;
 
-static spinlock_t term_lock;
-static void sys_write(uint64_t fd, const char* buf, uint64_t len) {
+#define WRITE_CHUNK 512
+
+// Rejects ranges that reach into the kernel half, wraparound included
+static bool user_range_ok(const void* p, uint64_t len) {
+    uint64_t start = (uint64_t)p;
+    return start + len >= start && start + len <= USER_ADDR_END;
+}
+
+/*
+ * Writes a user buffer from address space `cr3` to the console. The buffer is
+ * translated once per page and copied into the log in WRITE_CHUNK pieces
+ * rather than byte by byte. Only user bytes the log accepted are counted as
+ * written; the log only refuses them when it cannot drain (see klog_write).
+ */
+int64_t kernel_write(uint64_t cr3, uint64_t fd, const char* buf, uint64_t len) {
     if (fd != 1 && fd != 2) {
-        return;
+        return -1;
+    }
+    if (!user_range_ok(buf, len)) {
+        return -1;
+    }
+    int level = fd == 2 ? KLOG_ERR : KLOG_INFO;
+    char chunk[WRITE_CHUNK];
+    size_t used = 0;
+    size_t prefix = 0;     // non-user bytes at the start of chunk
+
+    if (fd == 2) {
+        memcpy(chunk, "[ ERROR ] ", 10);
+        used = prefix = 10;
     }
-    spinlock_acquire(&term_lock);
-    if (fd == 2)
-        printf("[ ERROR ] ");
 
-    for (uint64_t i = 0; i < len; i++) {
-        uint64_t vaddr = (uint64_t)buf + i;
-        uint64_t phys = virt_to_phys_in_pml4(current_thread->context.cr3, (void*)vaddr);
+    uint64_t done = 0;
+    while (done < len) {
+        uint64_t vaddr = (uint64_t)buf + done;
+        uint64_t phys = user_virt_to_phys(cr3, vaddr, false);
         if (phys == 0) {
+            klog_write(level, chunk, used);
             printf("\n[ SYSCALL ERROR ] Bad userspace address: %#llx\n", vaddr);
-            spinlock_release(&term_lock);
-            return;
+            return -1;
+        }
+
+        size_t n = PAGE_SIZE - (vaddr & (PAGE_SIZE - 1));
+        if (n > len - done)
+            n = len - done;
+        if (n > sizeof(chunk) - used)
+            n = sizeof(chunk) - used;
+
+        memcpy(chunk + used, (const char*)(phys + hhdm), n);
+        used += n;
+        done += n;
+
+        if (used == sizeof(chunk) || done == len) {
+            size_t put = klog_write(level, chunk, used);
+            if (put < used)
+                return (int64_t)(done - (used - (put > prefix ? put : prefix)));
+            used = prefix = 0;
         }
-        char* kernel_ptr = (char*)(phys + hhdm);
-        kputchar(*kernel_ptr);
     }
-    spinlock_release(&term_lock);
+    return (int64_t)len;
 }
 
-static uint64_t sys_fork(struct InterruptFrame* frame, uint64_t flags __attribute__((unused)), void* child_stack) {
+/*
+ * Copies `len` bytes to user address `dst` in address space `cr3`. Fails on
+ * anything ring 3 could not write itself (kernel half, read-only pages).
+ */
+int copy_to_user(uint64_t cr3, void* dst, const void* src, size_t len) {
+    if (!user_range_ok(dst, len))
+        return -1;
+    size_t done = 0;
+    while (done < len) {
+        uint64_t vaddr = (uint64_t)dst + done;
+        uint64_t phys = user_virt_to_phys(cr3, vaddr, true);
+        if (phys == 0)
+            return -1;
+        size_t chunk = PAGE_SIZE - (vaddr & (PAGE_SIZE - 1));
+        if (chunk > len - done)
+            chunk = len - done;
+        memcpy((void*)(phys + hhdm), (const uint8_t*)src + done, chunk);
+        done += chunk;
+    }
+    return 0;
+}
+
+/* Copies `len` bytes from user address `src` in address space `cr3` */
+int copy_from_user(uint64_t cr3, void* dst, const void* src, size_t len) {
+    if (!user_range_ok(src, len))
+        return -1;
+    size_t done = 0;
+    while (done < len) {
+        uint64_t vaddr = (uint64_t)src + done;
+        uint64_t phys = user_virt_to_phys(cr3, vaddr, false);
+        if (phys == 0)
+            return -1;
+        size_t chunk = PAGE_SIZE - (vaddr & (PAGE_SIZE - 1));
+        if (chunk > len - done)
+            chunk = len - done;
+        memcpy((uint8_t*)dst + done, (const void*)(phys + hhdm), chunk);
+        done += chunk;
+    }
+    return 0;
+}
+
+static int64_t sys_write(InterruptFrame* frame, const uint64_t* args) {
+    return kernel_write(current_thread->context.cr3, args[0], (const char*)args[1], args[2]);
+}
+
+static int64_t sys_fork(InterruptFrame* frame, const uint64_t* args) {
+    void* child_stack = (void*)args[1];
     Process* proc = current_thread->process;
     
     void* user_stack = child_stack;
@@ -87,12 +178,15 @@ static uint64_t sys_fork(struct InterruptFrame* frame, uint64_t flags __attribut
     return child->tid;
 }
 
-static void sys_exit(int code) __attribute__((noreturn));
+static int64_t sys_exit(InterruptFrame* frame, const uint64_t* args) __attribute__((noreturn));
 
 static spinlock_t sched_lock;
-static void sys_exit(int code) {
+static int64_t sys_exit(InterruptFrame* frame, const uint64_t* args) {
+    int code = (int)args[0];
     current_thread->state = THREAD_STATE_DONE;
     printf("[ EXIT ] Thread TID %llu exited with code %d\n", current_thread->tid, code);
+    if (current_thread->process)
+        process_thread_exited(current_thread->process);
     spinlock_acquire(&sched_lock);
     __asm__ volatile("cli");
     extern Thread* schedule(void);
@@ -100,6 +194,7 @@ static void sys_exit(int code) {
     if (!next || next == current_thread || next->state == THREAD_STATE_DONE) {
         printf("[ KERNEL ] All threads completed. System halting.\n");
         spinlock_release(&sched_lock);
+        klog_panic();
         for(;;) __asm__ volatile("cli; hlt");
     }
     next->state = THREAD_STATE_RUNNING;
@@ -108,31 +203,123 @@ static void sys_exit(int code) {
     if (next->remaining_time == 0) {
         next->remaining_time = BASE_TIME_QUANTUM * next->priority;
     }
-    extern struct Tss tss;
-    tss.rsp0 = (uint64_t)next->kernel_stack_top;
+    set_kernel_stack((uint64_t)next->kernel_stack_top);
     spinlock_release(&sched_lock);
     extern void exit_to_thread(Thread* thread) __attribute__((noreturn));
     exit_to_thread(next);
 }
 
-static uint64_t sys_reboot() {
+static int64_t sys_reboot(InterruptFrame* frame, const uint64_t* args) {
     return current_thread->tid;
 }
 
-static void* syscall_handlers[SYSCALL_COUNT];
+static int64_t sys_ioring_setup(InterruptFrame* frame, const uint64_t* args) {
+    return ioring_setup(current_thread->process, (uint32_t)args[0], (uint32_t)args[1]);
+}
+
+static int64_t sys_ioring_enter(InterruptFrame* frame, const uint64_t* args) {
+    return ioring_enter(current_thread->process, (uint32_t)args[0], (uint32_t)args[1]);
+}
+
+static SyscallStats syscall_stats[SYSCALL_COUNT];
+
+/* args: syscall number, user pointer to a SyscallStats */
+static int64_t sys_syscall_stats(InterruptFrame* frame, const uint64_t* args) {
+    if (args[0] >= SYSCALL_COUNT)
+        return -1;
+    return copy_to_user(current_thread->context.cr3, (void*)args[1],
+                        &syscall_stats[args[0]], sizeof(SyscallStats));
+}
+
+/* args: cpu (IRQ_STATS_ALL_CPUS sums), vector, user pointer to an IrqStats */
+static int64_t sys_irq_stats(InterruptFrame* frame, const uint64_t* args) {
+    IrqStats st;
+    if (args[1] > 0xFF || irq_get_stats((int)args[0], (uint8_t)args[1], &st) < 0)
+        return -1;
+    return copy_to_user(current_thread->context.cr3, (void*)args[2], &st, sizeof(IrqStats));
+}
+
+/* args: PROF_OP_*, event, period */
+static int64_t sys_profile(InterruptFrame* frame, const uint64_t* args) {
+    switch (args[0]) {
+    case PROF_OP_START:
+        return profiler_start((int)args[1], args[2]);
+    case PROF_OP_STOP:
+        profiler_stop();
+        return 0;
+    case PROF_OP_DUMP:
+        profiler_dump();
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/* args: screen x, screen y, width, height; returns the surface's user address */
+static int64_t sys_gfx_map(InterruptFrame* frame, const uint64_t* args) {
+    return gfx_surface_map(current_thread->process, (int64_t)args[0], (int64_t)args[1],
+                           (uint32_t)args[2], (uint32_t)args[3]);
+}
+
+/* args: x, y, w, h of the changed region in surface coordinates */
+static int64_t sys_gfx_damage(InterruptFrame* frame, const uint64_t* args) {
+    return gfx_surface_damage(current_thread->process, (uint32_t)args[0], (uint32_t)args[1],
+                              (uint32_t)args[2], (uint32_t)args[3]);
+}
+
+#define KLOG_READ_CHUNK 1024
+
+/*
+ * args: user buffer, length, user pointer to a uint64_t cursor (0 for the
+ * oldest record kept). Returns bytes written and advances the cursor.
+ */
+static int64_t sys_klog_read(InterruptFrame* frame, const uint64_t* args) {
+    uint64_t cr3 = current_thread->context.cr3;
+    char* dst = (char*)args[0];
+    uint64_t len = args[1];
+    uint64_t cursor;
+    char chunk[KLOG_READ_CHUNK];
+
+    if (copy_from_user(cr3, &cursor, (const void*)args[2], sizeof(cursor)) < 0)
+        return -1;
+
+    uint64_t done = 0;
+    while (done < len) {
+        size_t want = len - done < sizeof(chunk) ? len - done : sizeof(chunk);
+        uint64_t next = cursor;
+        size_t n = klog_read_history(&next, chunk, want);
+        if (n == 0)
+            break;
+        if (copy_to_user(cr3, dst + done, chunk, n) < 0)
+            return -1;
+        cursor = next;
+        done += n;
+    }
+
+    if (copy_to_user(cr3, (void*)args[2], &cursor, sizeof(cursor)) < 0)
+        return -1;
+    return (int64_t)done;
+}
+
+static const SyscallDesc syscall_table[SYSCALL_COUNT] = {
+    [SYS_WRITE]         = { "write",         sys_write,         3, 0 },
+    [SYS_FORK]          = { "fork",          sys_fork,          2, 0 },
+    [SYS_EXIT]          = { "exit",          sys_exit,          1, SYSCALL_F_NORETURN },
+    [SYS_REBOOT]        = { "reboot",        sys_reboot,        0, 0 },
+    [SYS_IORING_SETUP]  = { "ioring_setup",  sys_ioring_setup,  2, 0 },
+    [SYS_IORING_ENTER]  = { "ioring_enter",  sys_ioring_enter,  2, 0 },
+    [SYS_SYSCALL_STATS] = { "syscall_stats", sys_syscall_stats, 2, 0 },
+    [SYS_IRQ_STATS]     = { "irq_stats",     sys_irq_stats,     3, 0 },
+    [SYS_PROFILE]       = { "profile",       sys_profile,       3, 0 },
+    [SYS_GFX_MAP]       = { "gfx_map",       sys_gfx_map,       4, 0 },
+    [SYS_GFX_DAMAGE]    = { "gfx_damage",    sys_gfx_damage,    4, 0 },
+    [SYS_KLOG_READ]     = { "klog_read",     sys_klog_read,     3, 0 },
+};
 
 extern void syscall_entry_fast(void);
 
 void syscall_init(void) {
-    for (size_t i = 0; i < SYSCALL_COUNT; i++) {
-        syscall_handlers[i] = NULL;
-    }
-    spinlock_init(&term_lock);
     spinlock_init(&sched_lock);
-    syscall_handlers[1] = (void*)sys_write;
-    syscall_handlers[57] = (void*)sys_fork;
-    syscall_handlers[60] = (void*)sys_exit;
-    syscall_handlers[88] = (void*)sys_reboot;
     uint64_t efer = rdmsr(IA32_EFER_MSR);
     efer |= (1 << 0);  // SCE = bit 0
     wrmsr(IA32_EFER_MSR, efer);
@@ -148,21 +335,9 @@ void syscall_init(void) {
 
 void syscall_handler(struct InterruptFrame* frame) {
     uint64_t syscall_number = frame->rax;
-    if (syscall_number < SYSCALL_COUNT && syscall_handlers[syscall_number]) {
-        uint64_t ret;
-        if (syscall_number == 60) {
-            sys_exit((int)frame->rdi);
-            __builtin_unreachable();
-        }
-        if (syscall_number == 57) {
-            ret = sys_fork(frame, frame->rdi, (void*)frame->rsi);
-        } else {
-            typedef uint64_t (*syscall_func_t)(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t);
-            syscall_func_t handler = (syscall_func_t)syscall_handlers[syscall_number];
-            ret = handler(frame->rdi, frame->rsi, frame->rdx, frame->r10, frame->r8, frame->r9);
-        }
-        frame->rax = ret;
-    } else {
+    const SyscallDesc* desc = syscall_number < SYSCALL_COUNT ? &syscall_table[syscall_number] : NULL;
+
+    if (!desc || !desc->handler) {
         printf("[ ERROR ] Unknown syscall number: %llu from TID %llu\n", syscall_number, current_thread->tid);
         terminate_process(current_thread->process, -1);
         while(1) {
@@ -170,4 +345,24 @@ void syscall_handler(struct InterruptFrame* frame) {
         }
         __builtin_unreachable();
     }
+
+    const uint64_t regs[6] = { frame->rdi, frame->rsi, frame->rdx, frame->r10, frame->r8, frame->r9 };
+    uint64_t args[6] = { 0 };
+    for (uint8_t i = 0; i < desc->nargs; i++)
+        args[i] = regs[i];
+
+    SyscallStats* st = &syscall_stats[syscall_number];
+    st->calls++;
+
+    if (desc->flags & SYSCALL_F_NORETURN) {
+        desc->handler(frame, args);
+        __builtin_unreachable();
+    }
+
+    uint64_t start = rdtsc();
+    int64_t ret = desc->handler(frame, args);
+    latency_record(&st->total_cycles, &st->max_cycles, st->hist, SYSCALL_HIST_BUCKETS,
+                   rdtsc() - start);
+
+    frame->rax = (uint64_t)ret;
 }
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <arch/x86_64/vectors.h>
+
+#include <system/multitasking/spinlock.h>
+
+// Fixed gates inside the device range are never handed out
+static bool vector_used[256] = {
+    [SYSCALL_VECTOR] = true,
+};
+static spinlock_t vector_lock;
+
+/*
+ * Allocate `count` consecutive device vectors, aligned to `count` (rounded up
+ * to a power of two) as multi-message MSI requires. Returns the first vector
+ * or -1 when the range is exhausted.
+ */
+int vector_alloc_range(uint32_t count)
+{
+    uint32_t align = 1;
+    while (align < count)
+        align <<= 1;
+
+    spinlock_acquire(&vector_lock);
+    uint32_t first = (DEVICE_VECTOR_FIRST + align - 1) & ~(align - 1);
+    for (uint32_t v = first; v + count - 1 <= DEVICE_VECTOR_LAST; v += align) {
+        bool free = true;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (vector_used[v + i]) {
+                free = false;
+                break;
+            }
+        }
+        if (!free)
+            continue;
+        for (uint32_t i = 0; i < count; ++i)
+            vector_used[v + i] = true;
+        spinlock_release(&vector_lock);
+        return (int)v;
+    }
+    spinlock_release(&vector_lock);
+    return -1;
+}
+
+int vector_alloc(void)
+{
+    return vector_alloc_range(1);
+}
+
+void vector_free(int vector)
+{
+    if (vector < DEVICE_VECTOR_FIRST || vector > DEVICE_VECTOR_LAST || vector == SYSCALL_VECTOR)
+        return;
+    spinlock_acquire(&vector_lock);
+    vector_used[vector] = false;
+    spinlock_release(&vector_lock);
+}
@@ -0,0 +1,216 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <arch/x86_64/cpu.h>
+
+#include <drivers/video/blit.h>
+
+/*
+ * The kernel is built without SSE and does not save FPU state, so every
+ * kernel here is integer-only: string instructions for fill and copy, and a
+ * two-channels-per-multiply blend.
+ */
+
+static void fill_stosd(uint32_t* dst, uint32_t color, size_t count) {
+    __asm__ volatile ("rep stosl" : "+D"(dst), "+c"(count) : "a"(color) : "memory");
+}
+
+static void copy_movsq(uint32_t* dst, const uint32_t* src, size_t count) {
+    size_t qwords = count / 2;
+    size_t rest = count & 1;
+    __asm__ volatile ("rep movsq" : "+D"(dst), "+S"(src), "+c"(qwords) : : "memory");
+    __asm__ volatile ("rep movsl" : "+D"(dst), "+S"(src), "+c"(rest) : : "memory");
+}
+
+// Enhanced rep movsb beats movsq for all but tiny rows and needs no tail
+static void copy_movsb(uint32_t* dst, const uint32_t* src, size_t count) {
+    size_t bytes = count * 4;
+    __asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(bytes) : : "memory");
+}
+
+// For overlapping rows where dst lies above src in memory
+static void copy_backward_movsd(uint32_t* dst, const uint32_t* src, size_t count) {
+    if (count == 0)
+        return;
+    dst += count - 1;
+    src += count - 1;
+    __asm__ volatile ("std\n\trep movsl\n\tcld" : "+D"(dst), "+S"(src), "+c"(count) : : "memory");
+}
+
+static inline uint32_t blend_pixel(uint32_t d, uint32_t s, uint32_t a) {
+    uint32_t ia = 255 - a;
+    uint32_t rb = (s & 0x00FF00FF) * a + (d & 0x00FF00FF) * ia;
+    uint32_t g  = (s & 0x0000FF00) * a + (d & 0x0000FF00) * ia;
+    // x / 255 as (x + 128 + (x + 128) / 256) / 256, both lanes at once
+    rb = ((rb + 0x00800080 + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    g  = ((g + 0x00008000 + ((g >> 8) & 0x0000FF00)) >> 8) & 0x0000FF00;
+    return (d & 0xFF000000) | rb | g;
+}
+
+static void blend_scalar(uint32_t* dst, const uint32_t* src, size_t count, uint32_t alpha) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t s = src[i];
+        uint32_t a = s >> 24;
+        if (alpha != 255)
+            a = (a * alpha + 127) / 255;
+        if (a == 0)
+            continue;
+        dst[i] = a == 255 ? s : blend_pixel(dst[i], s, a);
+    }
+}
+
+static const BlitRowOps row_ops_movsq = {
+    .name = "movsq",
+    .fill = fill_stosd,
+    .copy = copy_movsq,
+    .copy_backward = copy_backward_movsd,
+    .blend = blend_scalar,
+};
+
+static const BlitRowOps row_ops_erms = {
+    .name = "erms",
+    .fill = fill_stosd,
+    .copy = copy_movsb,
+    .copy_backward = copy_backward_movsd,
+    .blend = blend_scalar,
+};
+
+const BlitRowOps* blit_ops = &row_ops_movsq;
+
+void blit_init(void) {
+    if (cpu_has(CPU_FEAT_ERMS) || cpu_has(CPU_FEAT_FSRM))
+        blit_ops = &row_ops_erms;
+    printf("[ BLIT ] Using %s row kernels\n", blit_ops->name);
+}
+
+static inline uint32_t* surface_row(const DfbSurface* s, uint32_t x, uint32_t y) {
+    return (uint32_t*)((uint8_t*)s->pixels + (size_t)y * s->pitch) + x;
+}
+
+static inline int64_t max64(int64_t a, int64_t b) { return a > b ? a : b; }
+static inline int64_t min64(int64_t a, int64_t b) { return a < b ? a : b; }
+
+/*
+ * Clip a w x h operation at (dx, dy) against dst and, if given, the matching
+ * source window at (sx, sy) against src. Shifts both origins together so
+ * the pixel correspondence is kept; false when nothing is left.
+ */
+static bool clip_rect(const DfbSurface* dst, int32_t* dx, int32_t* dy,
+                      const DfbSurface* src, int32_t* sx, int32_t* sy,
+                      uint32_t* w, uint32_t* h) {
+    int64_t x0 = *dx, y0 = *dy;
+    int64_t x1 = x0 + *w, y1 = y0 + *h;
+
+    x0 = max64(x0, 0);
+    y0 = max64(y0, 0);
+    x1 = min64(x1, dst->width);
+    y1 = min64(y1, dst->height);
+
+    if (src != NULL) {
+        int64_t ox = (int64_t)*sx - *dx;
+        int64_t oy = (int64_t)*sy - *dy;
+        x0 = max64(x0, -ox);
+        y0 = max64(y0, -oy);
+        x1 = min64(x1, (int64_t)src->width - ox);
+        y1 = min64(y1, (int64_t)src->height - oy);
+        if (x1 > x0 && y1 > y0) {
+            *sx = (int32_t)(x0 + ox);
+            *sy = (int32_t)(y0 + oy);
+        }
+    }
+
+    if (x1 <= x0 || y1 <= y0)
+        return false;
+
+    *dx = (int32_t)x0;
+    *dy = (int32_t)y0;
+    *w = (uint32_t)(x1 - x0);
+    *h = (uint32_t)(y1 - y0);
+    return true;
+}
+
+DfbRect blit_fill(DfbSurface* dst, int32_t x, int32_t y, uint32_t w, uint32_t h, uint32_t color) {
+    if (!clip_rect(dst, &x, &y, NULL, NULL, NULL, &w, &h))
+        return (DfbRect){ 0, 0, 0, 0 };
+
+    for (uint32_t row = 0; row < h; row++)
+        blit_ops->fill(surface_row(dst, x, y + row), color, w);
+
+    return (DfbRect){ x, y, w, h };
+}
+
+DfbRect blit_copy(DfbSurface* dst, int32_t dx, int32_t dy,
+                  const DfbSurface* src, int32_t sx, int32_t sy, uint32_t w, uint32_t h) {
+    if (!clip_rect(dst, &dx, &dy, src, &sx, &sy, &w, &h))
+        return (DfbRect){ 0, 0, 0, 0 };
+
+    // Scrolling within one surface: walk rows and pixels away from the overlap
+    bool same = dst->pixels == src->pixels;
+    bool rows_up = !same || dy < sy || (dy == sy && dx <= sx);
+
+    for (uint32_t i = 0; i < h; i++) {
+        uint32_t row = rows_up ? i : h - 1 - i;
+        uint32_t* d = surface_row(dst, dx, dy + row);
+        const uint32_t* s = surface_row(src, sx, sy + row);
+        if (same && dy == sy && dx > sx)
+            blit_ops->copy_backward(d, s, w);
+        else
+            blit_ops->copy(d, s, w);
+    }
+
+    return (DfbRect){ dx, dy, w, h };
+}
+
+DfbRect blit_blend(DfbSurface* dst, int32_t dx, int32_t dy,
+                   const DfbSurface* src, int32_t sx, int32_t sy, uint32_t w, uint32_t h,
+                   uint8_t alpha) {
+    if (alpha == 0 || !clip_rect(dst, &dx, &dy, src, &sx, &sy, &w, &h))
+        return (DfbRect){ 0, 0, 0, 0 };
+
+    for (uint32_t row = 0; row < h; row++)
+        blit_ops->blend(surface_row(dst, dx, dy + row), surface_row(src, sx, sy + row), w, alpha);
+
+    return (DfbRect){ dx, dy, w, h };
+}
+
+DfbRect blit_bitmap(DfbSurface* dst, int32_t dx, int32_t dy,
+                    const uint8_t* bits, uint32_t bw, uint32_t bh, uint32_t stride,
+                    uint32_t scale_x, uint32_t scale_y, uint32_t fg, uint32_t bg) {
+    if (scale_x == 0 || scale_y == 0)
+        return (DfbRect){ 0, 0, 0, 0 };
+
+    // Clip in destination pixels, then map back to bitmap coordinates per pixel
+    int32_t x = dx, y = dy;
+    uint32_t w = bw * scale_x, h = bh * scale_y;
+    if (!clip_rect(dst, &x, &y, NULL, NULL, NULL, &w, &h))
+        return (DfbRect){ 0, 0, 0, 0 };
+
+    uint32_t ox = (uint32_t)(x - dx), oy = (uint32_t)(y - dy);
+
+    for (uint32_t row = 0; row < h; row++) {
+        const uint8_t* line = bits + (size_t)((oy + row) / scale_y) * stride;
+        uint32_t* d = surface_row(dst, x, y + row);
+
+        // Emit runs of equal bits so solid stretches become one fill
+        uint32_t col = 0;
+        while (col < w) {
+            uint32_t fx = (ox + col) / scale_x;
+            bool set = (line[fx / 8] >> (7 - fx % 8)) & 1;
+            uint32_t run = 1;
+            while (col + run < w) {
+                uint32_t nx = (ox + col + run) / scale_x;
+                if ((bool)((line[nx / 8] >> (7 - nx % 8)) & 1) != set)
+                    break;
+                run++;
+            }
+            uint32_t color = set ? fg : bg;
+            if (color != BLIT_TRANSPARENT)
+                blit_ops->fill(d + col, color, run);
+            col += run;
+        }
+    }
+
+    return (DfbRect){ x, y, w, h };
+}
@@ -0,0 +1,303 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arch/x86_64/cpu.h>
+
+#include <hardware/requests.h>
+#include <hardware/memory/pmm.h>
+#include <hardware/memory/paging.h>
+#include <hardware/memory/heap.h>
+
+#include <drivers/video/dfb.h>
+#include <drivers/video/compositor.h>
+
+#include <system/term.h>
+#include <system/multitasking/softirq.h>
+#include <system/multitasking/spinlock.h>
+#include <system/multitasking/tasksched.h>
+
+static GfxSurface *surfaces[GFX_MAX_SURFACES];   // bottom to top
+static size_t surface_count;
+static bool dfb_ready;
+static uint32_t screen_width, screen_height;
+
+/*
+ * The console is the bottom layer: flanterm draws into its RAM shadow and
+ * hands over changed rows, which are composed like any other damage. Rows
+ * that arrive while a pass holds gfx_lock wait in console_rows for the
+ * softirq.
+ */
+static DfbSurface console;
+static bool console_layer;
+static uint32_t console_y0, console_y1;     // pending rows; empty when y0 >= y1
+static spinlock_t console_rows_lock;
+
+static spinlock_t gfx_lock;                 // dfb and surfaces[]; taken with IRQs off
+
+static inline int32_t max32(int32_t a, int32_t b) { return a > b ? a : b; }
+static inline int32_t min32(int32_t a, int32_t b) { return a < b ? a : b; }
+
+// Redraw one screen rectangle from every surface that covers it, bottom up
+static void compose_rect(int32_t x0, int32_t y0, int32_t x1, int32_t y1) {
+    for (size_t i = 0; i < surface_count; i++) {
+        GfxSurface *s = surfaces[i];
+        int32_t ix0 = max32(x0, s->x);
+        int32_t iy0 = max32(y0, s->y);
+        int32_t ix1 = min32(x1, s->x + (int32_t)s->pixels.width);
+        int32_t iy1 = min32(y1, s->y + (int32_t)s->pixels.height);
+        if (ix1 <= ix0 || iy1 <= iy0)
+            continue;
+        dfb_blit(&s->pixels, ix0 - s->x, iy0 - s->y,
+                 (uint32_t)(ix1 - ix0), (uint32_t)(iy1 - iy0), ix0, iy0);
+    }
+}
+
+// Redraw a screen rectangle from the bottom: console first, then the surfaces
+static void compose_screen_rect(int32_t x0, int32_t y0, int32_t x1, int32_t y1) {
+    x0 = max32(x0, 0);
+    y0 = max32(y0, 0);
+    x1 = min32(x1, (int32_t)screen_width);
+    y1 = min32(y1, (int32_t)screen_height);
+    if (x1 <= x0 || y1 <= y0)
+        return;
+    if (console_layer)
+        dfb_blit(&console, x0, y0, (uint32_t)(x1 - x0), (uint32_t)(y1 - y0), x0, y0);
+    compose_rect(x0, y0, x1, y1);
+}
+
+static void compose_rows(uint32_t y0, uint32_t y1) {
+    compose_screen_rect(0, (int32_t)y0, (int32_t)screen_width, (int32_t)y1);
+}
+
+static void compositor_softirq(void) {
+    bool dirty = false;
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&gfx_lock);
+
+    spinlock_acquire(&console_rows_lock);
+    uint32_t y0 = console_y0, y1 = console_y1;
+    console_y0 = console_y1 = 0;
+    spinlock_release(&console_rows_lock);
+    if (y0 < y1) {
+        compose_rows(y0, y1);
+        dirty = true;
+    }
+
+    for (size_t i = 0; i < surface_count; i++) {
+        GfxSurface *s = surfaces[i];
+        if (s->damage.w == 0)
+            continue;
+        int32_t x = s->x + (int32_t)s->damage.x;
+        int32_t y = s->y + (int32_t)s->damage.y;
+        compose_rect(x, y, x + (int32_t)s->damage.w, y + (int32_t)s->damage.h);
+        s->damage.w = 0;
+        dirty = true;
+    }
+
+    if (dirty)
+        dfb_swapbuffers();
+
+    spinlock_release(&gfx_lock);
+    irq_restore(flags);
+}
+
+/*
+ * flanterm's present hook: console rows [y0, y1) changed in the shadow.
+ * Compose them right away when the screen is free. A pass already running
+ * (possibly the one this console write interrupted, e.g. on a panic) gets
+ * them deferred to the softirq instead of deadlocking.
+ */
+static void compositor_console_present(void *arg, size_t y0, size_t y1) {
+    uint64_t flags = irq_save();
+    if (spinlock_try_acquire(&gfx_lock)) {
+        compose_rows((uint32_t)y0, (uint32_t)y1);
+        dfb_swapbuffers();
+        spinlock_release(&gfx_lock);
+        irq_restore(flags);
+        return;
+    }
+
+    spinlock_acquire(&console_rows_lock);
+    if (console_y0 >= console_y1) {
+        console_y0 = (uint32_t)y0;
+        console_y1 = (uint32_t)y1;
+    } else {
+        if (y0 < console_y0)
+            console_y0 = (uint32_t)y0;
+        if (y1 > console_y1)
+            console_y1 = (uint32_t)y1;
+    }
+    spinlock_release(&console_rows_lock);
+    irq_restore(flags);
+
+    raise_softirq(SOFTIRQ_COMPOSE);
+}
+
+void compositor_init(void) {
+    spinlock_init(&gfx_lock);
+    spinlock_init(&console_rows_lock);
+    open_softirq(SOFTIRQ_COMPOSE, compositor_softirq);
+}
+
+// The back buffer is a full-screen allocation; only pay for it once a client shows up
+static bool compositor_start(void) {
+    if (dfb_ready)
+        return true;
+
+    struct limine_framebuffer *fb = get_framebuffer()->framebuffers[0];
+    if (fb->bpp != 32)
+        return false;
+
+    screen_width = (uint32_t)fb->width;
+    screen_height = (uint32_t)fb->height;
+    if (!dfb_init(screen_width, screen_height, (uint32_t)fb->pitch, term_framebuffer()))
+        return false;
+
+    // From here on the console reaches the screen only through dfb
+    uint32_t *shadow = term_console_pixels();
+    uint64_t flags = irq_save();
+    spinlock_acquire(&gfx_lock);
+    if (shadow) {
+        console = (DfbSurface){ shadow, screen_width, screen_height, (uint32_t)fb->pitch };
+        console_layer = true;
+        term_set_present(compositor_console_present, NULL);
+        compose_rows(0, screen_height);
+        dfb_swapbuffers();
+    }
+    dfb_ready = true;
+    spinlock_release(&gfx_lock);
+    irq_restore(flags);
+
+    printf("[ GFX ] Compositor on %ux%u\n", screen_width, screen_height);
+    return true;
+}
+
+int64_t gfx_surface_map(Process *proc, int64_t x, int64_t y, uint32_t width, uint32_t height) {
+    if (proc->surface)
+        return -GFX_EBUSY;
+    if (!compositor_start())
+        return -GFX_ENODEV;
+    if (width == 0 || height == 0 || width > screen_width || height > screen_height)
+        return -GFX_EINVAL;
+    // Keeps every screen coordinate the compositor derives within int32
+    if (x < -(int64_t)width || x > (int64_t)screen_width ||
+        y < -(int64_t)height || y > (int64_t)screen_height)
+        return -GFX_EINVAL;
+    if (surface_count == GFX_MAX_SURFACES)
+        return -GFX_EBUSY;
+
+    size_t bytes = (size_t)width * height * 4;
+    size_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    uintptr_t phys = alloc_pages(pages);
+    if (!phys)
+        return -GFX_ENOMEM;
+
+    GfxSurface *s = kmalloc(sizeof(GfxSurface));
+    if (!s) {
+        for (size_t i = 0; i < pages; i++)
+            free_page(phys + i * PAGE_SIZE);
+        return -GFX_ENOMEM;
+    }
+
+    uint32_t *base = virt_addr(phys);
+    memset(base, 0, pages * PAGE_SIZE);
+
+    s->owner = proc;
+    s->pixels = (DfbSurface){ base, width, height, width * 4 };
+    s->phys = phys;
+    s->pages = pages;
+    s->x = (int32_t)x;
+    s->y = (int32_t)y;
+    s->damage = (DfbRect){ 0, 0, width, height };   // show the cleared surface
+
+    // Ordinary RAM: write-back is right, the compositor reads it through the HHDM
+    for (size_t i = 0; i < pages; i++) {
+        if (mapPage_in_pml4(proc->cr3, (void *)(GFX_SURFACE_USER_ADDR + i * PAGE_SIZE),
+                            (void *)(phys + i * PAGE_SIZE),
+                            PG_PRESENT | PG_WRITABLE | PG_USER | PG_NX))
+            continue;
+        while (i-- > 0)
+            unmapPage_in_pml4(proc->cr3, (void *)(GFX_SURFACE_USER_ADDR + i * PAGE_SIZE));
+        for (size_t j = 0; j < pages; j++)
+            free_page(phys + j * PAGE_SIZE);
+        kfree(s);
+        return -GFX_ENOMEM;
+    }
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&gfx_lock);
+    surfaces[surface_count++] = s;
+    proc->surface = s;
+    spinlock_release(&gfx_lock);
+    irq_restore(flags);
+
+    raise_softirq(SOFTIRQ_COMPOSE);
+    return (int64_t)GFX_SURFACE_USER_ADDR;
+}
+
+int64_t gfx_surface_damage(Process *proc, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    GfxSurface *s = proc->surface;
+    if (!s)
+        return -GFX_EINVAL;
+    if (x >= s->pixels.width || y >= s->pixels.height || w == 0 || h == 0)
+        return 0;
+    if ((uint64_t)x + w > s->pixels.width)
+        w = s->pixels.width - x;
+    if ((uint64_t)y + h > s->pixels.height)
+        h = s->pixels.height - y;
+
+    // Pending damage is a single bounding box; clients submit about once a frame
+    uint64_t flags = irq_save();
+    spinlock_acquire(&gfx_lock);
+    if (s->damage.w == 0) {
+        s->damage = (DfbRect){ x, y, w, h };
+    } else {
+        uint32_t x0 = x < s->damage.x ? x : s->damage.x;
+        uint32_t y0 = y < s->damage.y ? y : s->damage.y;
+        uint32_t x1 = x + w > s->damage.x + s->damage.w ? x + w : s->damage.x + s->damage.w;
+        uint32_t y1 = y + h > s->damage.y + s->damage.h ? y + h : s->damage.y + s->damage.h;
+        s->damage = (DfbRect){ x0, y0, x1 - x0, y1 - y0 };
+    }
+    spinlock_release(&gfx_lock);
+    irq_restore(flags);
+
+    raise_softirq(SOFTIRQ_COMPOSE);
+    return 0;
+}
+
+/*
+ * Process exit: take the surface off the screen, show what was under it and
+ * give its pages back. Unmapped first so no thread of the owner can still
+ * write to the freed memory.
+ */
+void gfx_surface_release(Process *proc) {
+    GfxSurface *s = proc->surface;
+    if (!s)
+        return;
+
+    uint64_t flags = irq_save();
+    spinlock_acquire(&gfx_lock);
+    for (size_t i = 0; i < surface_count; i++) {
+        if (surfaces[i] != s)
+            continue;
+        memmove(&surfaces[i], &surfaces[i + 1], (surface_count - i - 1) * sizeof(surfaces[0]));
+        surface_count--;
+        break;
+    }
+    proc->surface = NULL;
+    compose_screen_rect(s->x, s->y, s->x + (int32_t)s->pixels.width, s->y + (int32_t)s->pixels.height);
+    dfb_swapbuffers();
+    spinlock_release(&gfx_lock);
+    irq_restore(flags);
+
+    for (size_t i = 0; i < s->pages; i++)
+        unmapPage_in_pml4(proc->cr3, (void *)(GFX_SURFACE_USER_ADDR + i * PAGE_SIZE));
+    for (size_t i = 0; i < s->pages; i++)
+        free_page(s->phys + i * PAGE_SIZE);
+    kfree(s);
+}
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -17,7 +18,13 @@ uint32_t fb_pitch;
 
 uint32_t fb_size;
 
-void dfb_init(uint32_t width, uint32_t height, uint32_t pitch, void* framebuffer_addr) {
+static DfbRect damage[DFB_MAX_DAMAGE];
+static size_t damage_count;
+
+static DfbSurface back_surface;
+static DfbSurface front_surface;
+
+bool dfb_init(uint32_t width, uint32_t height, uint32_t pitch, void* framebuffer_addr) {
     fb_width = width;
     fb_height = height;
     fb_pitch = pitch;
@@ -26,36 +33,190 @@ void dfb_init(uint32_t width, uint32_t height, uint32_t pitch, void* framebuffer
 
     if (!framebuffer_addr) {
         printf("[ DFB ERROR ] Framebuffer address is NULL!\n");
-        for (;;) { __asm__("cli; hlt"); }
+        return false;
     }
     front_buffer = framebuffer_addr;
     back_buffer = kmalloc(fb_size);
-    extern void* getPhysicalAddress(void* virtual_address);
-    void* phys_check = getPhysicalAddress(back_buffer);
-    printf("[ DFB ] getPhysicalAddress(back_buffer=%p) = %p\n", back_buffer, phys_check);
-
     if (!back_buffer) {
         printf("[ DFB ERROR ] Failed to allocate back buffer!\n");
-        for (;;) { __asm__("cli; hlt"); }
+        return false;
+    }
+
+    back_surface = (DfbSurface){ back_buffer, width, height, pitch };
+    front_surface = (DfbSurface){ front_buffer, width, height, pitch };
+    blit_init();
+
+    // Start from what is on screen so nothing outside later damage changes
+    blit_copy(&back_surface, 0, 0, &front_surface, 0, 0, width, height);
+    damage_count = 0;
+    return true;
+}
+
+static inline uint32_t* dfb_row(uint32_t x, uint32_t y) {
+    return (uint32_t*)((uint8_t*)back_buffer + (size_t)y * fb_pitch + (size_t)x * 4);
+}
+
+// Clip (x, y, w, h) to the screen; false if nothing is left
+static bool dfb_clip(uint32_t* x, uint32_t* y, uint32_t* w, uint32_t* h) {
+    if (*x >= fb_width || *y >= fb_height || *w == 0 || *h == 0) {
+        return false;
+    }
+    if ((uint64_t)*x + *w > fb_width) {
+        *w = fb_width - *x;
+    }
+    if ((uint64_t)*y + *h > fb_height) {
+        *h = fb_height - *y;
+    }
+    return true;
+}
+
+static inline uint64_t rect_area(const DfbRect* r) {
+    return (uint64_t)r->w * r->h;
+}
+
+static DfbRect rect_union(const DfbRect* a, const DfbRect* b) {
+    uint32_t x0 = a->x < b->x ? a->x : b->x;
+    uint32_t y0 = a->y < b->y ? a->y : b->y;
+    uint32_t x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    uint32_t y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+    return (DfbRect){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+static inline bool rect_contains(const DfbRect* outer, const DfbRect* inner) {
+    return inner->x >= outer->x && inner->y >= outer->y
+        && inner->x + inner->w <= outer->x + outer->w
+        && inner->y + inner->h <= outer->y + outer->h;
+}
+
+/*
+ * Add r to the damage list. A rectangle absorbs r when their union costs no
+ * more pixels than copying both separately (overlapping or edge-adjacent
+ * rects); the union is then re-inserted so merges cascade. When the list is
+ * full, r goes into whichever rect grows the least.
+ */
+static void damage_add(DfbRect r) {
+    for (;;) {
+        bool merged = false;
+        for (size_t i = 0; i < damage_count; i++) {
+            if (rect_contains(&damage[i], &r)) {
+                return;
+            }
+            DfbRect u = rect_union(&damage[i], &r);
+            if (rect_area(&u) <= rect_area(&damage[i]) + rect_area(&r)) {
+                damage[i] = damage[--damage_count];
+                r = u;
+                merged = true;
+                break;
+            }
+        }
+        if (!merged) {
+            break;
+        }
     }
+
+    if (damage_count < DFB_MAX_DAMAGE) {
+        damage[damage_count++] = r;
+        return;
+    }
+
+    size_t best = 0;
+    uint64_t best_growth = UINT64_MAX;
+    for (size_t i = 0; i < damage_count; i++) {
+        DfbRect u = rect_union(&damage[i], &r);
+        uint64_t growth = rect_area(&u) - rect_area(&damage[i]);
+        if (growth < best_growth) {
+            best_growth = growth;
+            best = i;
+        }
+    }
+    DfbRect u = rect_union(&damage[best], &r);
+    damage[best] = damage[--damage_count];
+    damage_add(u);
+}
+
+void dfb_damage(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    if (!dfb_clip(&x, &y, &w, &h)) {
+        return;
+    }
+    damage_add((DfbRect){ x, y, w, h });
+}
+
+void dfb_damage_all(void) {
+    damage[0] = (DfbRect){ 0, 0, fb_width, fb_height };
+    damage_count = 1;
 }
 
 void dfb_putpixel(uint32_t x, uint32_t y, uint32_t color) {
     if (x >= fb_width || y >= fb_height) {
         return;
     }
-    uint32_t* pixel_addr = (uint32_t*)((uint8_t*)back_buffer + y * fb_pitch + x * 4);
-    *pixel_addr = color;
+    *dfb_row(x, y) = color;
+
+    // Pixel-at-a-time drawing tends to stay inside the last damaged rect
+    if (damage_count != 0) {
+        DfbRect* last = &damage[damage_count - 1];
+        if (x >= last->x && x < last->x + last->w && y >= last->y && y < last->y + last->h) {
+            return;
+        }
+    }
+    damage_add((DfbRect){ x, y, 1, 1 });
+}
+
+void dfb_fill_span(uint32_t x, uint32_t y, uint32_t len, uint32_t color) {
+    dfb_fill_rect(x, y, len, 1, color);
+}
+
+void dfb_fill_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color) {
+    if (!dfb_clip(&x, &y, &w, &h)) {
+        return;
+    }
+    damage_add(blit_fill(&back_surface, x, y, w, h, color));
 }
 
 void dfb_fillscreen(uint32_t color) {
-    for (uint32_t y = 0; y < fb_height; y++) {
-        for (uint32_t x = 0; x < fb_width; x++) {
-            dfb_putpixel(x, y, color);
-        }
+    dfb_fill_rect(0, 0, fb_width, fb_height, color);
+}
+
+void dfb_blit(const DfbSurface* src, int32_t sx, int32_t sy, uint32_t w, uint32_t h, int32_t dx, int32_t dy) {
+    DfbRect r = blit_copy(&back_surface, dx, dy, src, sx, sy, w, h);
+    if (r.w != 0) {
+        damage_add(r);
+    }
+}
+
+void dfb_blend(const DfbSurface* src, int32_t sx, int32_t sy, uint32_t w, uint32_t h,
+               int32_t dx, int32_t dy, uint8_t alpha) {
+    DfbRect r = blit_blend(&back_surface, dx, dy, src, sx, sy, w, h, alpha);
+    if (r.w != 0) {
+        damage_add(r);
+    }
+}
+
+void dfb_draw_bitmap(const uint8_t* bits, uint32_t bw, uint32_t bh, uint32_t stride,
+                     int32_t dx, int32_t dy, uint32_t scale, uint32_t fg, uint32_t bg) {
+    DfbRect r = blit_bitmap(&back_surface, dx, dy, bits, bw, bh, stride, scale, scale, fg, bg);
+    if (r.w != 0) {
+        damage_add(r);
     }
 }
 
+DfbSurface* dfb_back_surface(void) {
+    return &back_surface;
+}
+
 void dfb_swapbuffers(void) {
-    memcpy(front_buffer, back_buffer, fb_size);
-}
\ No newline at end of file
+    for (size_t i = 0; i < damage_count; i++) {
+        DfbRect* r = &damage[i];
+
+        // Full-width damage is one contiguous run, pitch padding included
+        if (r->x == 0 && r->w == fb_width && fb_pitch % 4 == 0) {
+            size_t offset = (size_t)r->y * fb_pitch;
+            blit_ops->copy((uint32_t*)((uint8_t*)front_buffer + offset),
+                           (const uint32_t*)((uint8_t*)back_buffer + offset),
+                           (size_t)r->h * fb_pitch / 4);
+            continue;
+        }
+        blit_copy(&front_surface, r->x, r->y, &back_surface, r->x, r->y, r->w, r->h);
+    }
+    damage_count = 0;
+}
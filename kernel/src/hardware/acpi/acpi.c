@@ -24,6 +24,45 @@
 static struct limine_rsdp_response *rsdp_response;
 struct FADT *fadt;
 
+static XSDT *acpi_xsdt = NULL;
+static RSDT *acpi_rsdt = NULL;
+
+static ACPISDTHeader *mapTable(uintptr_t phys)
+{
+    ensure_mapped_phys_range(phys, sizeof(ACPISDTHeader));
+    ACPISDTHeader *h = (ACPISDTHeader *)virt_addr(phys);
+    ensure_mapped_phys_range(phys, h->Length);
+    return h;
+}
+
+/*
+ * Return the first table with the given signature from the XSDT (or RSDT
+ * on ACPI 1.0 firmware), or NULL. Valid once acpi_init() has run.
+ */
+void *acpi_find_table(const char *signature)
+{
+    if (acpi_xsdt) {
+        int entries = (acpi_xsdt->h.Length - sizeof(acpi_xsdt->h)) / 8;
+        for (int i = 0; i < entries; i++) {
+            uint64_t raw;
+            memcpy(&raw, (uint8_t*)acpi_xsdt->PointerToOtherSDT + i * 8, 8);
+            ACPISDTHeader *h = mapTable((uintptr_t)raw);
+            if (!strncmp(h->Signature, signature, 4))
+                return h;
+        }
+    } else if (acpi_rsdt) {
+        int entries = (acpi_rsdt->h.Length - sizeof(acpi_rsdt->h)) / 4;
+        for (int i = 0; i < entries; i++) {
+            uint32_t raw;
+            memcpy(&raw, (uint8_t*)acpi_rsdt->PointerToOtherSDT + i * 4, 4);
+            ACPISDTHeader *h = mapTable((uintptr_t)raw);
+            if (!strncmp(h->Signature, signature, 4))
+                return h;
+        }
+    }
+    return NULL;
+}
+
 static ACPISDTHeader *findFACP_in_XSDT(XSDT *xsdt)
 {
     int entries = (xsdt->h.Length - sizeof(xsdt->h)) / 8;
@@ -221,7 +260,8 @@ void acpi_init() {
             hcf();
         }
         ensure_mapped_phys_range((uintptr_t)xsdp->xsdt_address, xh->Length);
-        processXSDT((XSDT *)virt_addr((uintptr_t)xsdp->xsdt_address));
+        acpi_xsdt = (XSDT *)virt_addr((uintptr_t)xsdp->xsdt_address);
+        processXSDT(acpi_xsdt);
     } else {
         if (xsdp->rsdt_address == 0 || xsdp->rsdt_address > 0xFFFFFFFF) {
             printf("[ ACPI ERROR ] Invalid RSDT address!\n");
@@ -234,7 +274,8 @@ void acpi_init() {
             hcf();
         }
         ensure_mapped_phys_range((uintptr_t)xsdp->rsdt_address, rh->Length);
-        processRSDT((RSDT *)virt_addr((uintptr_t)xsdp->rsdt_address));
+        acpi_rsdt = (RSDT *)virt_addr((uintptr_t)xsdp->rsdt_address);
+        processRSDT(acpi_rsdt);
     }
 
     if (fadt) {
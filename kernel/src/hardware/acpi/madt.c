@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <hardware/acpi/acpi.h>
+#include <hardware/acpi/descriptor_tables/madt.h>
+
+MadtInfo madt_info;
+
+// Returns 0 on success, -1 if the firmware has no MADT
+int madt_init(void)
+{
+    memset(&madt_info, 0, sizeof(madt_info));
+
+    MADT *madt = (MADT *)acpi_find_table("APIC");
+    if (!madt) {
+        printf("[ MADT ] No MADT found\n");
+        return -1;
+    }
+
+    madt_info.lapic_phys = madt->lapic_address;
+
+    uint8_t *p = madt->entries;
+    uint8_t *end = (uint8_t *)madt + madt->h.Length;
+    while (p + sizeof(MADTEntryHeader) <= end) {
+        MADTEntryHeader *e = (MADTEntryHeader *)p;
+        if (e->length < sizeof(MADTEntryHeader) || p + e->length > end)
+            break;
+
+        switch (e->type) {
+        case MADT_ENTRY_LAPIC: {
+            MADTLapic *l = (MADTLapic *)e;
+            // bit 0: enabled, bit 1: online capable
+            if ((l->flags & 3) && madt_info.cpu_count < MADT_MAX_CPUS)
+                madt_info.cpu_apic_ids[madt_info.cpu_count++] = l->apic_id;
+            break;
+        }
+        case MADT_ENTRY_X2APIC: {
+            MADTX2Apic *l = (MADTX2Apic *)e;
+            if ((l->flags & 3) && madt_info.cpu_count < MADT_MAX_CPUS)
+                madt_info.cpu_apic_ids[madt_info.cpu_count++] = l->x2apic_id;
+            break;
+        }
+        case MADT_ENTRY_IOAPIC: {
+            MADTIoApic *io = (MADTIoApic *)e;
+            if (madt_info.ioapic_count < MADT_MAX_IOAPICS) {
+                MadtIoApicInfo *info = &madt_info.ioapics[madt_info.ioapic_count++];
+                info->id = io->id;
+                info->phys = io->address;
+                info->gsi_base = io->gsi_base;
+            }
+            break;
+        }
+        case MADT_ENTRY_ISO: {
+            MADTIso *iso = (MADTIso *)e;
+            if (madt_info.iso_count < MADT_MAX_ISOS) {
+                MadtIsoInfo *info = &madt_info.isos[madt_info.iso_count++];
+                info->source = iso->source;
+                info->gsi = iso->gsi;
+                info->flags = iso->flags;
+            }
+            break;
+        }
+        case MADT_ENTRY_LAPIC_OVERRIDE: {
+            uint64_t addr;
+            memcpy(&addr, p + 4, sizeof(addr));
+            madt_info.lapic_phys = addr;
+            break;
+        }
+        default:
+            break;
+        }
+        p += e->length;
+    }
+
+    printf("[ MADT ] %u CPUs, %u IOAPICs, %u overrides\n",
+           madt_info.cpu_count, madt_info.ioapic_count, madt_info.iso_count);
+    return 0;
+}
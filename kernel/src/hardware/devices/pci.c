@@ -1,4 +1,370 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
-#include <hardware/devices/pci.h>
\ No newline at end of file
+#include <arch/x86_64/percpu.h>
+#include <arch/x86_64/vectors.h>
+
+#include <hardware/devices/pci.h>
+#include <hardware/devices/pci_helpers.h>
+
+size_t mcfgentrycount;
+struct acpi_mcfg_allocation *mcfgentries;
+uint32_t (*pci_archread32)(int bus, int device, int function, uint32_t offset);
+void (*pci_archwrite32)(int bus, int device, int function, uint32_t offset, uint32_t value);
+
+static pcienum_t *enumhead;
+
+uint32_t pci_read32(int bus, int device, int function, uint32_t offset) {
+	return pci_archread32(bus, device, function, offset);
+}
+
+uint16_t pci_read16(int bus, int device, int function, uint32_t offset) {
+	return (pci_read32(bus, device, function, offset) >> ((offset & 2) * 8)) & 0xffff;
+}
+
+uint8_t pci_read8(int bus, int device, int function, uint32_t offset) {
+	return (pci_read32(bus, device, function, offset) >> ((offset & 3) * 8)) & 0xff;
+}
+
+void pci_write32(int bus, int device, int function, uint32_t offset, uint32_t value) {
+	pci_archwrite32(bus, device, function, offset, value);
+}
+
+void pci_write16(int bus, int device, int function, uint32_t offset, uint16_t v) {
+	int shift = (offset & 2) * 8;
+	uint32_t old = pci_read32(bus, device, function, offset);
+	old &= ~(0xffff << shift);
+	pci_write32(bus, device, function, offset, old | ((uint32_t)v << shift));
+}
+
+void pci_write8(int bus, int device, int function, uint32_t offset, uint8_t v) {
+	int shift = (offset & 3) * 8;
+	uint32_t old = pci_read32(bus, device, function, offset);
+	old &= ~(0xff << shift);
+	pci_write32(bus, device, function, offset, old | ((uint32_t)v << shift));
+}
+
+// use ECAM when the firmware describes it, port 0xcf8 otherwise
+void pci_archinit() {
+	pci_archread32 = legacy_read32;
+	pci_archwrite32 = legacy_write32;
+
+	struct acpi_mcfg *mcfg = acpi_find_table("MCFG");
+	if (mcfg == NULL)
+		return;
+
+	mcfgentrycount = (mcfg->hdr.Length - sizeof(struct acpi_mcfg)) / sizeof(struct acpi_mcfg_allocation);
+	if (mcfgentrycount == 0)
+		return;
+
+	mcfgentries = malloc(mcfgentrycount * sizeof(struct acpi_mcfg_allocation));
+	if (mcfgentries == NULL)
+		return;
+	memcpy(mcfgentries, mcfg->entries, mcfgentrycount * sizeof(struct acpi_mcfg_allocation));
+
+	for (size_t i = 0; i < mcfgentrycount; ++i) {
+		struct acpi_mcfg_allocation *entry = &mcfgentries[i];
+		size_t buscount = entry->end_bus - entry->start_bus + 1;
+		entry->address = (uint64_t)map_mmio_region(entry->address, MCFG_MAPPING_SIZE(buscount), MMIO_UC);
+	}
+
+	pci_archread32 = mcfg_read32;
+	pci_archwrite32 = mcfg_write32;
+	printf("[ PCI ] Using ECAM (%zu segment ranges)\n", mcfgentrycount);
+}
+
+int pci_getcapoffset(pcienum_t *e, int cap, int n) {
+	if ((PCI_READ16(e, PCI_CONFIG_STATUS) & PCI_STATUS_HASCAP) == 0)
+		return 0;
+
+	int offset = PCI_READ8(e, PCI_CONFIG_CAP) & ~0x3;
+	// bound the walk in case of a malformed (looping) list
+	for (int i = 0; offset && i < 48; ++i) {
+		if (PCI_READ8(e, offset) == cap && n-- == 0)
+			return offset;
+		offset = PCI_READ8(e, offset + 1) & ~0x3;
+	}
+
+	return 0;
+}
+
+pcibar_t pci_getbar(pcienum_t *e, int bar) {
+	pcibar_t ret = {0};
+	uint32_t offset = PCI_BAR_BASE + bar * 4;
+	uint32_t low = PCI_READ32(e, offset);
+
+	ret.mmio = (low & 1) == 0;
+	ret.is64bits = ret.mmio && ((low >> 1) & 3) == 2;
+	ret.prefetchable = ret.mmio && (low & 8);
+
+	// size the bar with decoding off so the probe pattern is never live
+	uint16_t command = PCI_READ16(e, PCI_CONFIG_COMMAND);
+	PCI_WRITE16(e, PCI_CONFIG_COMMAND, command & ~(PCI_COMMAND_IO | PCI_COMMAND_MMIO));
+
+	PCI_WRITE32(e, offset, 0xffffffff);
+	uint64_t mask = PCI_READ32(e, offset);
+	PCI_WRITE32(e, offset, low);
+
+	uint64_t physical = low & (ret.mmio ? ~0xfu : ~0x3u);
+	if (ret.is64bits) {
+		uint32_t high = PCI_READ32(e, offset + 4);
+		PCI_WRITE32(e, offset + 4, 0xffffffff);
+		mask |= (uint64_t)PCI_READ32(e, offset + 4) << 32;
+		PCI_WRITE32(e, offset + 4, high);
+		physical |= (uint64_t)high << 32;
+	} else {
+		mask |= ret.mmio ? 0xffffffff00000000ULL : 0xffffffffffff0000ULL;
+	}
+
+	PCI_WRITE16(e, PCI_CONFIG_COMMAND, command);
+
+	mask &= ret.mmio ? ~0xfULL : ~0x3ULL;
+	ret.physical = physical;
+	// an unimplemented bar reads back as all zeroes
+	ret.length = (mask & 0xffffffff) || ret.is64bits ? (size_t)(~mask + 1) : 0;
+	return ret;
+}
+
+void *pci_mapbar(pcibar_t bar) {
+	if (!bar.mmio || bar.length == 0)
+		return NULL;
+
+	return map_mmio_region(bar.physical, bar.length, MMIO_UC);
+}
+
+void pci_setcommand(pcienum_t *e, int mask, int v) {
+	uint16_t command = PCI_READ16(e, PCI_CONFIG_COMMAND);
+	if (v)
+		command |= mask;
+	else
+		command &= ~mask;
+	PCI_WRITE16(e, PCI_CONFIG_COMMAND, command);
+}
+
+pcienum_t *pci_getenum(int class, int subclass, int progif, int vendor, int deviceid, int revision, int n) {
+	for (pcienum_t *e = enumhead; e; e = e->next) {
+		if ((class >= 0 && e->class != class) || (subclass >= 0 && e->subclass != subclass) ||
+		    (progif >= 0 && e->progif != progif) || (vendor >= 0 && e->vendor != vendor) ||
+		    (deviceid >= 0 && e->deviceid != deviceid) || (revision >= 0 && e->revision != revision))
+			continue;
+		if (n-- == 0)
+			return e;
+	}
+
+	return NULL;
+}
+
+static uint32_t cpuapicid(int cpu) {
+	if (cpu < 0 || cpu >= MAX_CPUS || !percpu[cpu].online)
+		cpu = current_cpu_id();
+	uint32_t id = percpu[cpu].lapic_id;
+	// without interrupt remapping MSIs can only reach 8 bit APIC IDs
+	return id > 0xff ? percpu[0].lapic_id : id;
+}
+
+// MSI-X
+
+size_t pci_initmsix(pcienum_t *e) {
+	if (!e->msix.exists)
+		return 0;
+
+	uint16_t control = PCI_READ16(e, e->msix.offset + PCI_MSIX_CONTROL);
+	uint32_t table = PCI_READ32(e, e->msix.offset + PCI_MSIX_TABLE);
+	uint32_t pba = PCI_READ32(e, e->msix.offset + PCI_MSIX_PBA);
+
+	e->irq.msix.entrycount = (control & 0x7ff) + 1;
+	e->irq.msix.bir = table & 0x7;
+	e->irq.msix.tableoffset = table & ~0x7;
+	e->irq.msix.pbir = pba & 0x7;
+	e->irq.msix.pboffset = pba & ~0x7;
+
+	pcibar_t bar = e->bar[e->irq.msix.bir];
+	if (!bar.mmio || bar.length == 0)
+		return 0;
+
+	e->irq.msix.table = map_mmio_region(bar.physical + e->irq.msix.tableoffset,
+	                                    e->irq.msix.entrycount * PCI_MSIX_ENTRY_SIZE, MMIO_UC);
+
+	// every entry starts masked; pci_msixadd unmasks the ones in use
+	for (size_t i = 0; i < e->irq.msix.entrycount; ++i)
+		e->irq.msix.table[i * 4 + 3] |= PCI_MSIX_ENTRY_MASKED;
+
+	pci_setcommand(e, PCI_COMMAND_IRQDISABLE, 1);
+	PCI_WRITE16(e, e->msix.offset + PCI_MSIX_CONTROL, control | PCI_MSIX_CONTROL_ENABLE | PCI_MSIX_CONTROL_MASK);
+
+	return e->irq.msix.entrycount;
+}
+
+void pci_msixsetmask(pcienum_t *e, int v) {
+	uint16_t control = PCI_READ16(e, e->msix.offset + PCI_MSIX_CONTROL);
+	if (v)
+		control |= PCI_MSIX_CONTROL_MASK;
+	else
+		control &= ~PCI_MSIX_CONTROL_MASK;
+	PCI_WRITE16(e, e->msix.offset + PCI_MSIX_CONTROL, control);
+}
+
+void pci_msixadd_cpu(pcienum_t *e, int msixvec, int vec, int cpu, int edgetrigger, int deassert) {
+	if (e->irq.msix.table == NULL || msixvec < 0 || (size_t)msixvec >= e->irq.msix.entrycount)
+		return;
+
+	uint32_t data;
+	uint64_t address = msiformatmessage(&data, vec, edgetrigger, deassert, cpuapicid(cpu));
+	volatile uint32_t *entry = e->irq.msix.table + msixvec * 4;
+
+	// reprogram under the entry mask so the device never sees a torn message
+	entry[3] |= PCI_MSIX_ENTRY_MASKED;
+	entry[0] = address & 0xffffffff;
+	entry[1] = address >> 32;
+	entry[2] = data;
+	entry[3] &= ~PCI_MSIX_ENTRY_MASKED;
+}
+
+void pci_msixadd(pcienum_t *e, int msixvec, int vec, int edgetrigger, int deassert) {
+	pci_msixadd_cpu(e, msixvec, vec, current_cpu_id(), edgetrigger, deassert);
+}
+
+// allocate a vector for one MSI-X entry and point it at `cpu`; returns the vector.
+// the function mask set by pci_initmsix stays on until pci_msixsetmask(e, 0)
+int pci_msix_request(pcienum_t *e, int msixvec, irq_handler_t handler, void *ctx, int cpu) {
+	int vector = vector_alloc();
+	if (vector < 0)
+		return -1;
+
+	if (irq_request(vector, handler, ctx, 0, "msix") < 0) {
+		vector_free(vector);
+		return -1;
+	}
+	pci_msixadd_cpu(e, msixvec, vector, cpu, 1, 1);
+	return vector;
+}
+
+// MSI
+
+size_t pci_initmsi(pcienum_t *e, int requested) {
+	if (!e->msi.exists || requested <= 0)
+		return 0;
+
+	uint16_t control = PCI_READ16(e, e->msi.offset + PCI_MSI_CONTROL);
+	int capable = 1 << ((control >> 1) & 0x7);
+
+	int count = 1;
+	int log2 = 0;
+	while (count < requested && count < capable && count < 32) {
+		count <<= 1;
+		++log2;
+	}
+
+	control &= ~(0x7 << 4);
+	control |= log2 << 4;
+	control &= ~PCI_MSI_CONTROL_ENABLE;
+	PCI_WRITE16(e, e->msi.offset + PCI_MSI_CONTROL, control);
+
+	e->irq.msi.count = count;
+	return count;
+}
+
+void pci_msisetbase_cpu(pcienum_t *e, int base, int cpu, int edgetrigger, int deassert) {
+	uint32_t data;
+	uint64_t address = msiformatmessage(&data, base, edgetrigger, deassert, cpuapicid(cpu));
+	uint16_t control = PCI_READ16(e, e->msi.offset + PCI_MSI_CONTROL);
+
+	PCI_WRITE32(e, e->msi.offset + PCI_MSI_ADDRESS, address & 0xffffffff);
+	if (control & PCI_MSI_CONTROL_64BIT) {
+		PCI_WRITE32(e, e->msi.offset + PCI_MSI_ADDRESS + 4, address >> 32);
+		PCI_WRITE16(e, e->msi.offset + PCI_MSI_ADDRESS + 8, data);
+	} else {
+		PCI_WRITE16(e, e->msi.offset + PCI_MSI_ADDRESS + 4, data);
+	}
+
+	pci_setcommand(e, PCI_COMMAND_IRQDISABLE, 1);
+	PCI_WRITE16(e, e->msi.offset + PCI_MSI_CONTROL, control | PCI_MSI_CONTROL_ENABLE);
+}
+
+void pci_msisetbase(pcienum_t *e, int base, int edgetrigger, int deassert) {
+	pci_msisetbase_cpu(e, base, current_cpu_id(), edgetrigger, deassert);
+}
+
+// multi-message MSI shares one destination, so all `count` vectors land on `cpu`
+int pci_msi_request(pcienum_t *e, int count, irq_handler_t handler, void *ctx, int cpu) {
+	size_t granted = pci_initmsi(e, count);
+	if (granted == 0)
+		return -1;
+
+	int base = vector_alloc_range(granted);
+	if (base < 0)
+		return -1;
+
+	for (size_t i = 0; i < granted; ++i) {
+		if (irq_request(base + i, handler, ctx, 0, "msi") < 0) {
+			while (i--)
+				irq_free(base + i, handler, ctx);
+			for (size_t j = 0; j < granted; ++j)
+				vector_free(base + j);
+			return -1;
+		}
+	}
+
+	pci_msisetbase_cpu(e, base, cpu, 1, 1);
+	return base;
+}
+
+// enumeration
+
+static void addfunction(int bus, int device, int function) {
+	pcienum_t *e = malloc(sizeof(pcienum_t));
+	if (e == NULL)
+		return;
+	memset(e, 0, sizeof(pcienum_t));
+
+	e->bus = bus;
+	e->device = device;
+	e->function = function;
+	e->vendor = PCI_READ16(e, PCI_CONFIG_VENDOR);
+	e->deviceid = PCI_READ16(e, PCI_CONFIG_DEVICEID);
+	e->revision = PCI_READ8(e, PCI_CONFIG_REVISION);
+	e->progif = PCI_READ8(e, PCI_CONFIG_PROGIF);
+	e->subclass = PCI_READ8(e, PCI_CONFIG_SUBCLASS);
+	e->class = PCI_READ8(e, PCI_CONFIG_CLASS);
+	e->type = PCI_READ8(e, PCI_CONFIG_HEADERTYPE) & PCI_HEADERTYPE_MASK;
+
+	e->msi.offset = pci_getcapoffset(e, PCI_CAP_MSI, 0);
+	e->msi.exists = e->msi.offset != 0;
+	e->msix.offset = pci_getcapoffset(e, PCI_CAP_MSIX, 0);
+	e->msix.exists = e->msix.offset != 0;
+
+	if (e->type == PCI_HEADERTYPE_STANDARD) {
+		for (int i = 0; i < 6; ++i) {
+			e->bar[i] = pci_getbar(e, i);
+			// the upper half of a 64 bit bar is not a bar of its own
+			if (e->bar[i].is64bits && i < 5)
+				++i;
+		}
+	}
+
+	printf("[ PCI ] %02x:%02x.%x %04x:%04x class %02x:%02x%s%s\n", bus, device, function,
+	       e->vendor, e->deviceid, e->class, e->subclass,
+	       e->msi.exists ? " msi" : "", e->msix.exists ? " msi-x" : "");
+
+	e->next = enumhead;
+	enumhead = e;
+}
+
+void pci_init() {
+	pci_archinit();
+
+	for (int bus = 0; bus < 256; ++bus) {
+		for (int device = 0; device < 32; ++device) {
+			if (pci_read16(bus, device, 0, PCI_CONFIG_VENDOR) == 0xffff)
+				continue;
+
+			int functions = (pci_read8(bus, device, 0, PCI_CONFIG_HEADERTYPE) & PCI_HEADERTYPE_MULTIFUNCTION_MASK) ? 8 : 1;
+			for (int function = 0; function < functions; ++function) {
+				if (pci_read16(bus, device, function, PCI_CONFIG_VENDOR) == 0xffff)
+					continue;
+				addfunction(bus, device, function);
+			}
+		}
+	}
+}
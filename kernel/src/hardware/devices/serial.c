@@ -1,31 +1,116 @@
+#include <stdio.h>
+
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/irq.h>
+#include <arch/x86_64/apic/ioapic.h>
+
 #include <hardware/devices/io.h>
 #include <hardware/devices/serial.h>
-#include <arch/x86_64/isr.h>
-#include <stdio.h>
 
-static void serialInterruptHandler(InterruptFrame* frame) 
+#include <system/multitasking/spinlock.h>
+
+#define UART_RBR 0  // receive buffer (read)
+#define UART_THR 0  // transmit holding (write)
+#define UART_IER 1
+#define UART_IIR 2  // interrupt identification (read)
+#define UART_FCR 2  // FIFO control (write)
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+#define UART_MSR 6
+
+#define IER_RX_AVAIL  0x01
+#define IER_THRE      0x02
+
+#define LSR_DATA_READY 0x01
+#define LSR_THRE       0x20
+
+#define UART_FIFO_SIZE 16
+#define TX_LOCK_SPINS  100000   // polled writers' bound on waiting for tx_lock
+
+/*
+ * TX and RX rings; head/tail are free-running and masked on access. TX is
+ * filled by serial_write() and drained 16 bytes at a time by the THRE
+ * interrupt, RX is filled by the receive interrupt.
+ */
+static char tx_ring[SERIAL_TX_RING];
+static volatile uint32_t tx_head, tx_tail;
+static char rx_ring[SERIAL_RX_RING];
+static volatile uint32_t rx_head, rx_tail;
+
+static spinlock_t tx_lock;
+static bool tx_active = false;      // THRE interrupt enabled, FIFO refills pending
+static bool irq_driven = false;
+
+// Push up to one FIFO's worth from the TX ring once the FIFO is empty; tx_lock held
+static void tx_fill_fifo(void)
+{
+    if (IoRead8(COM1 + UART_LSR) & LSR_THRE) {
+        for (int i = 0; i < UART_FIFO_SIZE && tx_tail != tx_head; i++) {
+            IoWrite8(COM1 + UART_THR, tx_ring[tx_tail % SERIAL_TX_RING]);
+            tx_tail++;
+        }
+    }
+
+    bool want = tx_tail != tx_head;
+    if (want != tx_active) {
+        IoWrite8(COM1 + UART_IER, IER_RX_AVAIL | (want ? IER_THRE : 0));
+        tx_active = want;
+    }
+}
+
+static void rx_drain_fifo(void)
 {
-    printf("%d", frame->int_no);
-    char x[2];
-    x[0] = readSerial();
-    printf(x);
+    while (IoRead8(COM1 + UART_LSR) & LSR_DATA_READY) {
+        char c = IoRead8(COM1 + UART_RBR);
+        if (rx_head - rx_tail < SERIAL_RX_RING) {
+            rx_ring[rx_head % SERIAL_RX_RING] = c;
+            rx_head++;
+        }
+    }
+}
+
+static void serialInterruptHandler(InterruptFrame* frame, void* ctx)
+{
+    (void)frame;
+    (void)ctx;
+
+    uint8_t iir;
+    while (!((iir = IoRead8(COM1 + UART_IIR)) & 1)) {
+        switch (iir & 0x0E) {
+        case 0x06:  // line status
+            IoRead8(COM1 + UART_LSR);
+            break;
+        case 0x04:  // received data
+        case 0x0C:  // character timeout
+            rx_drain_fifo();
+            break;
+        case 0x02:  // THR empty
+            spinlock_acquire(&tx_lock);
+            tx_fill_fifo();
+            spinlock_release(&tx_lock);
+            break;
+        default:    // modem status
+            IoRead8(COM1 + UART_MSR);
+            break;
+        }
+    }
 }
 
 bool initSerial() 
 {
-    registerInterruptHandler(0x24, &serialInterruptHandler);
-	outb(COM1 + 1, 0x00);	 // Disable all interrupts
-	outb(COM1 + 3, 0x80);	 // Enable DLAB (set baud rate divisor)
-	outb(COM1 + 0, 0x03);	 // Set divisor to 3 (lo byte) 38400 baud
-	outb(COM1 + 1, 0x00);
-	outb(COM1 + 3, 0x03);	 // 8 bits, no parity, one stop bit
-	outb(COM1 + 2, 0xC7);	 // Enable FIFO, clear them, with 14-byte threshold
-	outb(COM1 + 4, 0x0B);	 // IRQs enabled, RTS/DSR set
-	outb(COM1 + 4, 0x1E);	 // Set in loopback mode, test the serial chip
-	outb(COM1 + 0, 0xAE);	 // Test serial chip (send byte 0xAE and check if serial returns same byte)
+	IoWrite8(COM1 + 1, 0x00);	 // Disable all interrupts
+	IoWrite8(COM1 + 3, 0x80);	 // Enable DLAB (set baud rate divisor)
+	IoWrite8(COM1 + 0, 0x03);	 // Set divisor to 3 (lo byte) 38400 baud
+	IoWrite8(COM1 + 1, 0x00);
+	IoWrite8(COM1 + 3, 0x03);	 // 8 bits, no parity, one stop bit
+	IoWrite8(COM1 + 2, 0xC7);	 // Enable FIFO, clear them, with 14-byte threshold
+	IoWrite8(COM1 + 4, 0x0B);	 // IRQs enabled, RTS/DSR set
+	IoWrite8(COM1 + 4, 0x1E);	 // Set in loopback mode, test the serial chip
+	IoWrite8(COM1 + 0, 0xAE);	 // Test serial chip (send byte 0xAE and check if serial returns same byte)
  
 	// Check if serial is faulty (i.e: not same byte as sent)
-	if(inb(COM1 + 0) != 0xAE) 
+	if(IoRead8(COM1 + 0) != 0xAE) 
 	{
         printf("Serial broken");
 		return true;
@@ -33,20 +118,119 @@ bool initSerial()
  
 	// If serial is not faulty set it in normal operation mode
 	// (not-loopback with IRQs enabled and OUT#1 and OUT#2 bits enabled)
-	outb(COM1 + 4, 0x0F);
-	//outb(COM1 + 1, 0x0F);
+	IoWrite8(COM1 + 4, 0x0F);
 	return false;
 }
 
+// Route IRQ 4 and switch TX/RX to the rings; needs the IOAPIC
+bool serial_enable_irq(void)
+{
+    spinlock_init(&tx_lock);
+    if (ioapic_request_isa_irq(4, &serialInterruptHandler, NULL, IOAPIC_CPU_ANY) < 0)
+        return false;
+
+    IoWrite8(COM1 + UART_IER, IER_RX_AVAIL);
+    irq_driven = true;
+    return true;
+}
+
+static void serial_poll_byte(char c)
+{
+    while (!(IoRead8(COM1 + UART_LSR) & LSR_THRE))
+        ;
+    IoWrite8(COM1 + UART_THR, c);
+}
+
+/*
+ * Queue `len` bytes for transmission. With interrupts off (early boot,
+ * panic) or before serial_enable_irq() the bytes are sent by polling,
+ * since no THRE interrupt would arrive to drain the ring. Bytes already
+ * queued go out first so output stays in order.
+ *
+ * A panic can arrive from #DF/#MC on top of a context holding tx_lock on
+ * this CPU, so the polled path only waits a bounded time for the lock and
+ * otherwise writes past the ring instead of deadlocking.
+ */
+void serial_write(const char* s, size_t len)
+{
+    if (!irq_driven || !are_interrupts_enabled()) {
+        uint64_t flags = irq_save();
+        bool locked = false;
+        for (int spins = 0; irq_driven && !locked && spins < TX_LOCK_SPINS; spins++) {
+            locked = spinlock_try_acquire(&tx_lock);
+            if (!locked)
+                __asm__ volatile("pause");
+        }
+
+        while (locked && tx_tail != tx_head) {
+            serial_poll_byte(tx_ring[tx_tail % SERIAL_TX_RING]);
+            tx_tail++;
+        }
+        for (size_t i = 0; i < len; i++)
+            serial_poll_byte(s[i]);
+
+        // Ring is empty now: this drops THRE from IER if it was armed
+        if (locked) {
+            tx_fill_fifo();
+            spinlock_release(&tx_lock);
+        }
+        irq_restore(flags);
+        return;
+    }
+
+    while (len) {
+        uint64_t flags = irq_save();
+        spinlock_acquire(&tx_lock);
+
+        size_t space = SERIAL_TX_RING - (tx_head - tx_tail);
+        size_t n = len < space ? len : space;
+        for (size_t i = 0; i < n; i++)
+            tx_ring[(tx_head + i) % SERIAL_TX_RING] = s[i];
+        tx_head += n;
+        s += n;
+        len -= n;
+
+        // Idle transmitter: prime the FIFO, the THRE interrupt does the rest
+        if (!tx_active)
+            tx_fill_fifo();
+
+        spinlock_release(&tx_lock);
+        irq_restore(flags);
+
+        // Ring full: wait for the UART to make room
+        if (len)
+            __asm__ volatile("hlt");
+    }
+}
+
 bool isSerialReceived() 
 {
-	return inb(COM1 + 5) & 1;
+    if (irq_driven)
+        return rx_head != rx_tail;
+    return IoRead8(COM1 + UART_LSR) & LSR_DATA_READY;
 }
  
 char readSerial() 
 {
-	while (!isSerialReceived());
-	return inb(COM1);
+    if (!irq_driven) {
+        while (!isSerialReceived());
+        return IoRead8(COM1);
+    }
+
+    while (rx_head == rx_tail) {
+        // With IF masked (e.g. inside a syscall) hlt would never wake and
+        // nothing fills the ring, so poll the UART like serial_write does
+        if (!are_interrupts_enabled()) {
+            if (IoRead8(COM1 + UART_LSR) & LSR_DATA_READY)
+                return IoRead8(COM1 + UART_RBR);
+            __asm__ volatile("pause");
+            continue;
+        }
+        __asm__ volatile("hlt");
+    }
+    char c = rx_ring[rx_tail % SERIAL_RX_RING];
+    rx_tail++;
+    return c;
 }
 
 char* readSerialString(char* buffer, size_t len) 
@@ -66,14 +250,12 @@ char* readSerialString(char* buffer, size_t len)
 
 bool isTransmitEmpty() 
 {
-	return inb(COM1 + 5) & 0x20;
+	return IoRead8(COM1 + UART_LSR) & LSR_THRE;
 }
  
 void writeSerial(char a) 
 {
-	while (!isTransmitEmpty());
- 
-	outb(COM1, a);
+    serial_write(&a, 1);
 }
 
 void writeSerialString(const char* str) 
@@ -81,6 +263,7 @@ void writeSerialString(const char* str)
 	 size_t i = 0;
 	 while (str[i] != '\0') 
 	 {
-		  writeSerial(str[i++]);
+		  i++;
 	 }
-}
\ No newline at end of file
+	 serial_write(str, i);
+}
@@ -1,17 +1,36 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include <arch/x86_64/cpu.h>
+
 #include <hardware/memory/mmio.h>
 #include <hardware/memory/paging.h>
 
 static uintptr_t next_mmio_virt = MMIO_WINDOW_BASE;
 
-void *map_mmio_region(uintptr_t phys, size_t size, uint64_t flags) {
-    void *virt = (void *)next_mmio_virt;
+static uint64_t mmio_cache_flags(MmioType type) {
+    switch (type) {
+    case MMIO_WB: return PG_CACHE_WB;
+    case MMIO_WT: return PG_CACHE_WT;
+    // The PAT bit is reserved without PAT support; UC is the safe downgrade
+    case MMIO_WC: return cpu_has(CPU_FEAT_PAT) ? PG_CACHE_WC : PG_CACHE_UC;
+    case MMIO_UC:
+    default:      return PG_CACHE_UC;
+    }
+}
+
+void *map_mmio_region(uintptr_t phys, size_t size, MmioType type) {
+    // Registers need not be page aligned (IOAPICs, MSI-X tables)
+    uintptr_t offset = phys & (PAGE_SIZE - 1);
+    phys -= offset;
+    size += offset;
+
+    uint64_t flags = PG_PRESENT | PG_WRITABLE | PG_NX | mmio_cache_flags(type);
+    uintptr_t virt = next_mmio_virt;
     size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
     for (size_t i = 0; i < pages; ++i) {
-        mapPage((void *)(next_mmio_virt + i * PAGE_SIZE), (void *)(phys + i * PAGE_SIZE), flags);
+        mapPage((void *)(virt + i * PAGE_SIZE), (void *)(phys + i * PAGE_SIZE), flags);
     }
     next_mmio_virt += pages * PAGE_SIZE;
-    return virt;
-}
\ No newline at end of file
+    return (void *)(virt + offset);
+}
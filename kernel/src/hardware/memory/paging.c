@@ -7,8 +7,11 @@
 
 #include <kernel.h>
 
+#include <arch/x86_64/cpu.h>
+
 #include <hardware/memory/paging.h>
 #include <hardware/memory/pmm.h>
+#include <hardware/memory/tlb.h>
 #include <hardware/requests.h>
 
 extern struct limine_memmap_entry** memmaps;
@@ -28,23 +31,110 @@ uint64_t readCR3(void)
     return val;
 }
 
+static void setPageTableEntry(PageEntry *e, uint64_t flags, uint64_t phys_page) {
+    e->present    = (flags & PG_PRESENT) ? 1 : 0;
+    e->writable   = (flags & PG_WRITABLE) ? 1 : 0;
+    e->user_accessible = (flags & PG_USER) ? 1 : 0;
+    e->write_through_caching = (flags & PG_PWT) ? 1 : 0;
+    e->disable_cache = (flags & PG_PCD) ? 1 : 0;
+    e->null       = (flags & PG_PAT) ? 1 : 0;   // PAT on a PT leaf, never set on tables
+    e->global     = (flags & PG_GLOBAL) ? 1 : 0;
+    e->no_execute = (flags & PG_NX) ? 1 : 0;
+    e->physical_address = phys_page;
+}
+
+static inline bool is_kernel_half(uintptr_t virt) {
+    return virt >= 0xFFFF800000000000ULL;
+}
+
+// Shootdown domain for a change made through the current `pml4`
+static inline uint64_t tlbDomain(uintptr_t virt) {
+    return is_kernel_half(virt) ? TLB_KERNEL_CR3 : phys_addr(pml4);
+}
+
+// Mark every present leaf below a kernel-half table as global. Level 3 is
+// the PDPT, level 1 the PT; bit 7 (PS) terminates the walk early.
+static void markGlobal(PageTable *table, int level) {
+    for (size_t i = 0; i < 512; ++i) {
+        PageEntry *e = &table->entries[i];
+        if (!e->present)
+            continue;
+        if (level == 1 || (level < 4 && e->null)) {
+            e->global = 1;
+            continue;
+        }
+        markGlobal((PageTable *)virt_addr((uintptr_t)e->physical_address << 12), level - 1);
+    }
+}
+
+/*
+ * Interrupts and syscalls run on whatever CR3 is loaded, so the kernel half
+ * must be identical in every PML4. Allocate all 256 upper PDPTs now; since
+ * create_user_address_space() copies these entries, later kernel mappings
+ * land in shared tables and are visible everywhere. Kernel leaves are made
+ * global so switching CR3 does not evict them from the TLB.
+ */
+static void shareKernelHalf(void) {
+    for (size_t i = 256; i < 512; ++i) {
+        PageEntry *e = &pml4->entries[i];
+        if (e->present) {
+            markGlobal((PageTable *)virt_addr((uintptr_t)e->physical_address << 12), 3);
+            continue;
+        }
+
+        uint64_t phys = alloc_page();
+        if (!phys) {
+            printf("[ ERROR ] OOM while pre-populating kernel PML4[%llu]\n", i);
+            return;
+        }
+        memset(virt_addr(phys), 0, PAGE_SIZE);
+        setPageTableEntry(e, PG_PRESENT | PG_WRITABLE, phys >> 12);
+    }
+
+    // Setting CR4.PGE (or toggling it) flushes the whole TLB, globals included
+    uint64_t cr4;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    if (cr4 & CR4_PGE)
+        __asm__ volatile ("mov %0, %%cr4" :: "r"(cr4 & ~CR4_PGE) : "memory");
+    __asm__ volatile ("mov %0, %%cr4" :: "r"(cr4 | CR4_PGE) : "memory");
+}
+
+/*
+ * Program IA32_PAT with PAT_LAYOUT. Follows the SDM sequence for changing
+ * memory types: caches off and flushed around the write so no line keeps a
+ * stale type. Every CPU must load the same layout.
+ */
+void pat_init(void) {
+    if (!cpu_has(CPU_FEAT_PAT)) {
+        printf("[ PAT ] Not supported, WC mappings fall back to UC\n");
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    uint64_t cr0;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ volatile ("mov %0, %%cr0\n\twbinvd"
+                      :: "r"((cr0 | (1ULL << 30)) & ~(1ULL << 29)) : "memory");
+
+    wrmsr(IA32_PAT_MSR, PAT_LAYOUT);
+
+    __asm__ volatile ("wbinvd\n\tmov %%cr3, %%rax\n\tmov %%rax, %%cr3" ::: "rax", "memory");
+    __asm__ volatile ("mov %0, %%cr0" :: "r"(cr0) : "memory");
+    irq_restore(flags);
+}
+
 PageTable* initPML4() {
     uintptr_t cr3 = (uintptr_t)readCR3();
     kernel_cr3_phys = cr3 & ~0xFFF;
 
     uintptr_t pml4_phys = (cr3 >> 12) << 12;
     pml4 = (PageTable *)virt_addr(pml4_phys);
+    // Before the CR4.PGE toggle below, which drops global entries as well
+    pat_init();
+    shareKernelHalf();
     return pml4;
 }
 
-static void setPageTableEntry(PageEntry *e, uint64_t flags, uint64_t phys_page) {
-    e->present    = (flags & PG_PRESENT) ? 1 : 0;
-    e->writable   = (flags & PG_WRITABLE) ? 1 : 0;
-    e->user_accessible = (flags & PG_USER) ? 1 : 0;
-    e->no_execute = (flags & PG_NX) ? 1 : 0;
-    e->physical_address = phys_page;
-}
-
 void* getPhysicalAddress(void* virtual_address) 
 {
     uintptr_t virt = (uintptr_t)virtual_address;
@@ -108,7 +198,7 @@ static void allocateEntry(PageTable* table, size_t index, uint64_t flags)
     setPageTableEntry(&table->entries[index], entry_flags, phys >> 12);
 }
 
-void mapPage(void* virtual_address, void* physical_address, uint64_t flags) 
+bool mapPage(void* virtual_address, void* physical_address, uint64_t flags) 
 {
     uintptr_t virtual_address_int = (uintptr_t) virtual_address;
     uintptr_t physical_address_int = (uintptr_t) physical_address;
@@ -121,7 +211,7 @@ void mapPage(void* virtual_address, void* physical_address, uint64_t flags)
     if (!pml4->entries[pml4_index].present) {
         allocateEntry(pml4, pml4_index, flags);
         if (!pml4->entries[pml4_index].present) {
-             return;
+             return false;
         }
     } else {
         if (flags & PG_USER) pml4->entries[pml4_index].user_accessible = 1;
@@ -134,7 +224,7 @@ void mapPage(void* virtual_address, void* physical_address, uint64_t flags)
     if (!page_directory_pointer->entries[page_directory_pointer_index].present) {
         allocateEntry(page_directory_pointer, page_directory_pointer_index, flags);
         if (!page_directory_pointer->entries[page_directory_pointer_index].present) {
-             return;
+             return false;
         }
     } else {
         if (flags & PG_USER) page_directory_pointer->entries[page_directory_pointer_index].user_accessible = 1;
@@ -147,7 +237,7 @@ void mapPage(void* virtual_address, void* physical_address, uint64_t flags)
         allocateEntry(page_directory, page_directory_index, flags);
         if (!page_directory->entries[page_directory_index].present) {
              printf("[ ERROR ] Failed to allocate PD entry %llu\n", page_directory_index);
-             return;
+             return false;
         }
     } else {
         if (flags & PG_USER) page_directory->entries[page_directory_index].user_accessible = 1;
@@ -156,11 +246,21 @@ void mapPage(void* virtual_address, void* physical_address, uint64_t flags)
 
     PageTable* page_table = (PageTable*) virt_addr((uintptr_t)(page_directory->entries[page_directory_index].physical_address << 12));
 
+    if (is_kernel_half(virtual_address_int) && !(flags & PG_USER))
+        flags |= PG_GLOBAL;
+
+    bool was_present = page_table->entries[page_table_index].present;
+
     setPageTableEntry(&page_table->entries[page_table_index],
                       flags | PG_PRESENT,
                       physical_address_int >> 12);
 
-    flushTLB(virtual_address);
+    // Replacing a live translation may leave stale copies on other CPUs
+    if (was_present)
+        tlb_flush_page(tlbDomain(virtual_address_int), virtual_address_int);
+    else
+        flushTLB(virtual_address);
+    return true;
 }
 
 void map_region(void *virt, void *phys, size_t size, uint64_t flags) {
@@ -189,24 +289,44 @@ uintptr_t page_base(void *p) {
     return ((uintptr_t)p) & ~(PAGE_SIZE - 1);
 }
 
-void unmapPage(void *virtual_address) {
-    uintptr_t virt = (uintptr_t)virtual_address;
+static bool clearPageEntry(uintptr_t virt) {
     uint64_t pml4_i  = (virt >> 39) & 0x1FF;
     uint64_t pdpt_i  = (virt >> 30) & 0x1FF;
     uint64_t pd_i    = (virt >> 21) & 0x1FF;
     uint64_t pt_i    = (virt >> 12) & 0x1FF;
 
     // Presence checks for each level
-    if (!pml4->entries[pml4_i].present) return;
+    if (!pml4->entries[pml4_i].present) return false;
     PageTable *pdpt = (PageTable *)virt_addr((uintptr_t)pml4->entries[pml4_i].physical_address << 12);
-    if (!pdpt->entries[pdpt_i].present) return;
+    if (!pdpt->entries[pdpt_i].present) return false;
     PageTable *pd   = (PageTable *)virt_addr((uintptr_t)pdpt->entries[pdpt_i].physical_address << 12);
-    if (!pd->entries[pd_i].present) return;
+    if (!pd->entries[pd_i].present) return false;
     PageTable *pt   = (PageTable *)virt_addr((uintptr_t)pd->entries[pd_i].physical_address << 12);
-    if (!pt->entries[pt_i].present) return;
+    if (!pt->entries[pt_i].present) return false;
 
     pt->entries[pt_i].present = 0;
-    flushTLB(virtual_address);
+    return true;
+}
+
+void unmapPage(void *virtual_address) {
+    uintptr_t virt = (uintptr_t)virtual_address;
+    if (clearPageEntry(virt))
+        tlb_flush_page(tlbDomain(virt), virt);
+}
+
+// Unmap a range with a single shootdown for the whole batch
+void unmap_region(void *virt, size_t size) {
+    uintptr_t v = (uintptr_t)virt;
+    size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    TlbBatch batch;
+    tlb_batch_init(&batch, tlbDomain(v));
+    for (size_t i = 0; i < pages; ++i) {
+        uintptr_t page = v + i * PAGE_SIZE;
+        if (clearPageEntry(page))
+            tlb_batch_add(&batch, page);
+    }
+    tlb_batch_flush(&batch);
 }
 
 void page_inc_live(void *block) {
@@ -226,7 +346,7 @@ static PageTable *pml4_from_phys(uint64_t phys) {
     return (PageTable *)virt_addr(phys);
 }
 
-void mapPage_in_pml4(uint64_t pml4_phys, void *virt, void *phys, uint64_t flags) {
+bool mapPage_in_pml4(uint64_t pml4_phys, void *virt, void *phys, uint64_t flags) {
     PageTable *save = pml4;
     pml4 = pml4_from_phys(pml4_phys);
     
@@ -236,7 +356,15 @@ void mapPage_in_pml4(uint64_t pml4_phys, void *virt, void *phys, uint64_t flags)
         //       pml4_phys, virt, phys, flags, !!(flags & PG_NX));
     //}
     
-    mapPage(virt, phys, flags);
+    bool ok = mapPage(virt, phys, flags);
+    pml4 = save;
+    return ok;
+}
+
+void unmapPage_in_pml4(uint64_t pml4_phys, void *virt) {
+    PageTable *save = pml4;
+    pml4 = pml4_from_phys(pml4_phys);
+    unmapPage(virt);
     pml4 = save;
 }
 
@@ -272,6 +400,34 @@ uint64_t virt_to_phys_in_pml4(uint64_t pml4_phys, void *virt) {
     return phys_base + offset;
 }
 
+/*
+ * Translate a user address for a copy the kernel makes on the process's
+ * behalf. Unlike virt_to_phys_in_pml4 every level must grant user access
+ * (and write access when `write`), as the CPU would require of ring 3, and
+ * 1 GiB and 2 MiB leaves are followed. Returns 0 if the access would fault.
+ */
+uint64_t user_virt_to_phys(uint64_t pml4_phys, uintptr_t va, bool write) {
+    if (va >= USER_ADDR_END)
+        return 0;
+
+    PageTable *table = (PageTable *)virt_addr(pml4_phys);
+    for (int level = 4; level >= 1; level--) {
+        unsigned shift = 12 + 9 * (level - 1);
+        PageEntry *e = &table->entries[(va >> shift) & 0x1FF];
+        if (!e->present || !e->user_accessible || (write && !e->writable))
+            return 0;
+
+        uint64_t base = (uint64_t)e->physical_address << 12;
+        // PS (the `null` bit) ends the walk at the PDPT and PD levels
+        if (level == 1 || ((level == 2 || level == 3) && e->null)) {
+            uint64_t size = 1ULL << shift;
+            return (base & ~(size - 1)) + (va & (size - 1));
+        }
+        table = (PageTable *)virt_addr(base);
+    }
+    return 0;
+}
+
 void debug_walk_paging(uint64_t pml4_phys, uint64_t virt) {
     PageTable *pml4 = (PageTable *)virt_addr(pml4_phys);
     
@@ -55,21 +55,40 @@ uintptr_t alloc_page() {
     return ret;
 }
 
+/*
+ * Returns the lowest address of `num_pages` physically contiguous pages.
+ * The free list is built in ascending order, so pages pop off it in
+ * descending runs; look for a run of the right length and unlink it.
+ */
 uintptr_t alloc_pages(size_t num_pages) {
-    uintptr_t first_page = 0;
-    for (size_t i = 0; i < num_pages; ++i) {
-        uintptr_t page = alloc_page();
-        if (page == 0) {
-            for (size_t j = 0; j < i; ++j) {
-                free_page(first_page + j * PAGE_SIZE);
-            }
-            return 0;
+    if (num_pages == 0)
+        return 0;
+    if (num_pages == 1)
+        return alloc_page();
+
+    struct FreeBlock *before_run = NULL;
+    struct FreeBlock *prev = NULL;
+    size_t run_len = 0;
+
+    for (struct FreeBlock *b = free_list_head; b; prev = b, b = b->next) {
+        if (run_len && (uintptr_t)b == (uintptr_t)prev - PAGE_SIZE) {
+            run_len++;
+        } else {
+            before_run = prev;
+            run_len = 1;
         }
-        if (i == 0) {
-            first_page = page;
+
+        if (run_len == num_pages) {
+            if (before_run)
+                before_run->next = b->next;
+            else
+                free_list_head = b->next;
+            return (uintptr_t)b - hhdm;
         }
     }
-    return first_page;
+
+    printf("[PMM] alloc_pages: No contiguous run of %zu pages!\n", num_pages);
+    return 0;
 }
 
 void free_page(uintptr_t phys) {
@@ -0,0 +1,154 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <arch/x86_64/irq.h>
+#include <arch/x86_64/percpu.h>
+#include <arch/x86_64/apic/ipi.h>
+
+#include <hardware/memory/paging.h>
+#include <hardware/memory/tlb.h>
+
+/*
+ * One shootdown request is in flight at a time. The initiator publishes the
+ * batch, sends IPIs to the CPUs in `pending` and waits for each of them to
+ * clear its bit from the IPI handler.
+ */
+static struct {
+    volatile int       lock;
+    const TlbBatch*    batch;
+    volatile uint64_t  pending;
+} shootdown;
+
+static bool tlb_ready = false;
+
+static inline void invlpg(uintptr_t virt)
+{
+    __asm__ volatile ("invlpg (%0)" :: "r"(virt) : "memory");
+}
+
+static void flush_all(bool include_global)
+{
+    if (include_global) {
+        // Toggling CR4.PGE drops global entries too
+        uint64_t cr4;
+        __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+        __asm__ volatile ("mov %0, %%cr4" :: "r"(cr4 & ~CR4_PGE) : "memory");
+        __asm__ volatile ("mov %0, %%cr4" :: "r"(cr4) : "memory");
+    } else {
+        __asm__ volatile ("mov %%cr3, %%rax; mov %%rax, %%cr3" ::: "rax", "memory");
+    }
+}
+
+static void flush_local(const TlbBatch *batch)
+{
+    if (batch->full) {
+        flush_all(batch->cr3 == TLB_KERNEL_CR3);
+        return;
+    }
+    for (uint32_t i = 0; i < batch->count; ++i)
+        invlpg(batch->pages[i]);
+}
+
+static void service_shootdown(void)
+{
+    uint64_t bit = 1ULL << this_cpu()->cpu_id;
+    if (!(shootdown.pending & bit))
+        return;
+    flush_local(shootdown.batch);
+    __atomic_fetch_and(&shootdown.pending, ~bit, __ATOMIC_RELEASE);
+}
+
+static void tlb_shootdown_handler(InterruptFrame *frame, void *ctx)
+{
+    (void)frame;
+    (void)ctx;
+    service_shootdown();
+}
+
+void tlb_init(void)
+{
+    irq_request(IPI_TLB_SHOOTDOWN_VEC, &tlb_shootdown_handler, NULL, IRQF_SYSTEM, "tlb-shootdown");
+    tlb_ready = true;
+}
+
+void tlb_batch_init(TlbBatch *batch, uint64_t cr3)
+{
+    batch->cr3 = cr3;
+    batch->count = 0;
+    batch->full = false;
+}
+
+void tlb_batch_add(TlbBatch *batch, uintptr_t virt)
+{
+    if (batch->full)
+        return;
+    if (batch->count == TLB_BATCH_MAX) {
+        batch->full = true;
+        return;
+    }
+    batch->pages[batch->count++] = virt & ~(uintptr_t)(PAGE_SIZE - 1);
+}
+
+static uint64_t shootdown_targets(uint64_t cr3, uint32_t self)
+{
+    uint64_t mask = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; ++cpu) {
+        if (cpu == self || !percpu[cpu].online)
+            continue;
+        if (cr3 == TLB_KERNEL_CR3 || percpu[cpu].loaded_cr3 == cr3)
+            mask |= 1ULL << cpu;
+    }
+    return mask;
+}
+
+void tlb_batch_flush(TlbBatch *batch)
+{
+    if (!batch->count && !batch->full)
+        return;
+
+    if (!tlb_ready) {
+        flush_local(batch);
+        batch->count = 0;
+        batch->full = false;
+        return;
+    }
+
+    uint32_t self = this_cpu()->cpu_id;
+    uint64_t targets = shootdown_targets(batch->cr3, self);
+
+    if (targets) {
+        // Keep answering other initiators while we wait for the slot, or
+        // two CPUs shooting at each other with IRQs off would deadlock.
+        while (__atomic_exchange_n(&shootdown.lock, 1, __ATOMIC_ACQUIRE)) {
+            service_shootdown();
+            __asm__ volatile ("pause");
+        }
+
+        shootdown.batch = batch;
+        __atomic_store_n(&shootdown.pending, targets, __ATOMIC_RELEASE);
+        ipi_send_mask(targets, IPI_TLB_SHOOTDOWN_VEC);
+    }
+
+    // Local invalidation is only needed if this CPU can cache the mapping
+    if (batch->cr3 == TLB_KERNEL_CR3 || this_cpu()->loaded_cr3 == batch->cr3)
+        flush_local(batch);
+
+    if (targets) {
+        while (__atomic_load_n(&shootdown.pending, __ATOMIC_ACQUIRE))
+            __asm__ volatile ("pause");
+        shootdown.batch = NULL;
+        __atomic_store_n(&shootdown.lock, 0, __ATOMIC_RELEASE);
+    }
+
+    batch->count = 0;
+    batch->full = false;
+}
+
+void tlb_flush_page(uint64_t cr3, uintptr_t virt)
+{
+    TlbBatch batch;
+    tlb_batch_init(&batch, cr3);
+    tlb_batch_add(&batch, virt);
+    tlb_batch_flush(&batch);
+}
@@ -40,4 +40,15 @@ void tss_init()
 {
     memset(&tss, 0, sizeof(tss));
     tss.rsp0 = (uint64_t)interrupt_stack + sizeof(interrupt_stack);
+}
+
+_Static_assert(IST_COUNT == 3, "tss_set_ist() fills ist1..ist3");
+
+// `tops` holds IST_COUNT stack tops for slots 1..IST_COUNT. The TSS is
+// packed, so the fields are stored by name rather than through a pointer.
+void tss_set_ist(const uint64_t *tops)
+{
+    tss.ist1 = tops[0];
+    tss.ist2 = tops[1];
+    tss.ist3 = tops[2];
 }
\ No newline at end of file
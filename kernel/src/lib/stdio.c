@@ -3,7 +3,7 @@
 #include <stdint.h>
 #include <stddef.h>
 
-#include <system/term.h>
+#include <system/klog.h>
 
 typedef __typeof__( (size_t)0 - 1 ) ssize_t;
 
@@ -25,6 +25,19 @@ static void print_int(long long v, void (*out)(char))
     print_uint((unsigned long long)v, 10, 0, out);
 }
 
+// Longer output is truncated
+#define PRINTF_BUF_SIZE 512
+
+// Bounded output cursor; len keeps counting past cap like C's snprintf
+struct out { char *buf; size_t cap; size_t len; };
+
+static inline void out_c(struct out *o, char c)
+{
+    if (o->len + 1 < o->cap)
+        o->buf[o->len] = c;
+    o->len++;
+}
+
 enum { NONE, HH, H, L, LL, Z, T, J };
 
 static unsigned long long fetch_u(int mod, va_list ap)
@@ -55,13 +68,12 @@ static long long fetch_s(int mod, va_list ap)
     }
 }
 
-int printf(const char *fmt, ...)
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list ap)
 {
-    va_list ap; va_start(ap, fmt);
-    int written = 0;
+    struct out o = { buf, size, 0 };
 
     for (; *fmt; ++fmt) {
-        if (*fmt != '%') { kputchar(*fmt); ++written; continue; }
+        if (*fmt != '%') { out_c(&o, *fmt); continue; }
 
         // Flags
         int alt = 0, zero = 0, left = 0, plus = 0, space = 0;
@@ -105,9 +117,9 @@ int printf(const char *fmt, ...)
         case 'c': {
             char c = (char)va_arg(ap,int);
             int padlen = width > 1 ? width - 1 : 0;
-            if (!left) while (padlen--) { kputchar(pad); ++written; }
-            kputchar(c); ++written;
-            if (left) while (padlen--) { kputchar(' '); ++written; }
+            if (!left) while (padlen--) { out_c(&o, pad); }
+            out_c(&o, c);
+            if (left) while (padlen--) { out_c(&o, ' '); }
         } break;
 
         case 's': {
@@ -115,9 +127,9 @@ int printf(const char *fmt, ...)
             int slen = 0; const char *t = s;
             while (*t && (precision < 0 || slen < precision)) { ++slen; ++t; }
             int padlen = width > slen ? width - slen : 0;
-            if (!left) while (padlen--) { kputchar(pad); ++written; }
-            for (int i = 0; i < slen; ++i) { kputchar(*s++); ++written; }
-            if (left) while (padlen--) { kputchar(' '); ++written; }
+            if (!left) while (padlen--) { out_c(&o, pad); }
+            for (int i = 0; i < slen; ++i) { out_c(&o, *s++); }
+            if (left) while (padlen--) { out_c(&o, ' '); }
         } break;
 
         case 'd': case 'i': {
@@ -131,9 +143,9 @@ int printf(const char *fmt, ...)
             else if (plus) buf[len++] = '+';
             else if (space) buf[len++] = ' ';
             int padlen = width > len ? width - len : 0;
-            if (!left) while (padlen-- > 0) { kputchar(pad); ++written; }
-            while (len) { kputchar(buf[--len]); ++written; }
-            if (left) while (padlen-- > 0) { kputchar(' '); ++written; }
+            if (!left) while (padlen-- > 0) { out_c(&o, pad); }
+            while (len) { out_c(&o, buf[--len]); }
+            if (left) while (padlen-- > 0) { out_c(&o, ' '); }
         } break;
 
         case 'u': case 'o': case 'x': case 'X': {
@@ -147,9 +159,9 @@ int printf(const char *fmt, ...)
             if (alt && *fmt == 'x') { buf[len++] = 'x'; buf[len++] = '0'; }
             if (alt && *fmt == 'X') { buf[len++] = 'X'; buf[len++] = '0'; }
             int padlen = width > len ? width - len : 0;
-            if (!left) while (padlen-- > 0) { kputchar(pad); ++written; }
-            while (len) { kputchar(buf[--len]); ++written; }
-            if (left) while (padlen-- > 0) { kputchar(' '); ++written; }
+            if (!left) while (padlen-- > 0) { out_c(&o, pad); }
+            while (len) { out_c(&o, buf[--len]); }
+            if (left) while (padlen-- > 0) { out_c(&o, ' '); }
         } break;
 
         case 'p': {
@@ -159,20 +171,42 @@ int printf(const char *fmt, ...)
             buf[len++] = '0'; buf[len++] = 'x';
             for (int i = (sizeof(uintptr_t) * 2) - 1; i >= 0; --i)
                 buf[len++] = "0123456789abcdef"[(v >> (i * 4)) & 0xf];
-            for (int i = 0; i < len; ++i) { kputchar(buf[i]); ++written; }
+            for (int i = 0; i < len; ++i) { out_c(&o, buf[i]); }
         } break;
 
         case 'n': {
             int *ptr = va_arg(ap, int*);
-            *ptr = written;
+            *ptr = (int)o.len;
         } break;
 
-        case '%': kputchar('%'); ++written; break;
+        case '%': out_c(&o, '%'); break;
 
-        default : kputchar('?'); ++written; break;
+        default : out_c(&o, '?'); break;
         }
     }
 
+    if (size)
+        buf[o.len < size ? o.len : size - 1] = '\0';
+    return (int)o.len;
+}
+
+int snprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap; va_start(ap, fmt);
+    int n = vsnprintf(buf, size, fmt, ap);
     va_end(ap);
-    return written;
+    return n;
+}
+
+// Formats on the stack and hands the result to the kernel log ring
+int printf(const char *fmt, ...)
+{
+    char buf[PRINTF_BUF_SIZE];
+    va_list ap; va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    size_t len = (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1;
+    klog_write(KLOG_INFO, buf, len);
+    return n;
 }
\ No newline at end of file
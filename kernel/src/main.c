@@ -9,7 +9,9 @@
 
 #include <arch/x86_64/idt.h>
 #include <arch/x86_64/cpu.h>
+#include <arch/x86_64/percpu.h>
 #include <arch/x86_64/apic/apic.h>
+#include <arch/x86_64/apic/ioapic.h>
 #include <arch/x86_64/pic.h>
 
 #include <hardware/requests.h>
@@ -19,17 +21,24 @@
 #include <hardware/devices/io.h>
 #include <hardware/memory/gdt.h>
 #include <hardware/memory/tss.h>
+#include <hardware/memory/tlb.h>
 #include <hardware/acpi/acpi.h>
+#include <hardware/acpi/descriptor_tables/madt.h>
 #include <hardware/devices/pci.h>
 
 #include <drivers/video/dfb.h>
+#include <drivers/video/compositor.h>
 
+#include <system/klog.h>
 #include <system/term.h>
 #include <system/exec/user.h>
 #include <system/exec/elf64/ehdr64.h>
 #include <system/exec/elf64/phdr64.h>
 #include <system/exec/elf_enums.h>
+#include <system/multitasking/softirq.h>
 #include <system/multitasking/tasksched.h>
+#include <system/profile/profiler.h>
+#include <system/time/vclock.h>
 
 __attribute__((aligned(16)))
 uint8_t kernel_stack[0x4000];
@@ -57,9 +66,11 @@ void kmain(void) {
     }
 
     term_init();
+    cpu_detect();
     pmm_init();
     initPML4();
     heap_init();
+    term_map_framebuffer();
     calibrate_tsc();
 
     printf("[ KERNEL ] Initializing IDT...\n");
@@ -78,17 +89,16 @@ void kmain(void) {
     acpi_init();
     printf("[ OK ] ACPI Done.\n");
 
+    printf("[ KERNEL ] Initializing IOAPIC...\n");
+    madt_init();
+    ioapic_init();
+    printf("[ OK ] IOAPIC Done.\n");
+
     printf("[ KERNEL ] Starting APIC timer...\n");
     enableAPICTimer(1000);
     printf("[ OK ] Timer active.\n");
 
-    //printf("[ KERNEL ] Initializing PCI...\n");
-    //pci_init();
-    //printf("[ OK ] Done.\n");
-
-    printf("[ KERNEL ] Initializing Syscalls...\n");
-    syscall_init();
-    printf("[ OK ] Done.\n");
+    vclock_init();
 
     printf("[ INFO ] Hello, World from QuarkOS kernel!\n");
 
@@ -99,9 +109,27 @@ void kmain(void) {
     extern uint16_t gdt_tss_selector;
     asm volatile("ltr %w0" : : "r"(gdt_tss_selector));
     printf("[ KERNEL ] TSS loaded (selector %#x)\n", gdt_tss_selector);
+
+    // GS base and STAR selectors depend on the final GDT
+    percpu_init_bsp();
+    tlb_init();
+    profiler_init();
+    enableKeyboard();
+    enableSerialCOM1();
+
+    printf("[ KERNEL ] Initializing PCI...\n");
+    pci_init();
+    printf("[ OK ] Done.\n");
+
+    printf("[ KERNEL ] Initializing Syscalls...\n");
+    syscall_init();
+    printf("[ OK ] Done.\n");
     
     printf("[ KERNEL ] Initializing Scheduler...\n");
     scheduler_init();
+    softirq_init();
+    klog_init();
+    compositor_init();
 
     struct limine_module_response *mresp = module_request.response;
     if (mresp && mresp->module_count > 0) {
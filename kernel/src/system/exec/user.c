@@ -151,7 +151,8 @@ void enter_userspace(const UserImage *img)
         "mov %[cr3], %%rax\n\t"
         "mov %%rax, %%cr3\n\t"
 
-        // And perform the privilege switch
+        // And perform the privilege switch with the user GS base
+        "swapgs\n\t"
         "iretq\n\t"
         :
         : [cr3]"r"(img->cr3_phys),
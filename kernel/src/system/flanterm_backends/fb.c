@@ -51,6 +51,7 @@
 
 void *memset(void *, int, size_t);
 void *memcpy(void *, const void *, size_t);
+void *memmove(void *, const void *, size_t);
 
 #ifndef FLANTERM_FB_DISABLE_BUMP_ALLOC
 
@@ -607,22 +608,151 @@ static void push_to_queue(struct flanterm_context *_ctx, struct flanterm_fb_char
     q->c = *c;
 }
 
-static void flanterm_fb_revscroll(struct flanterm_context *_ctx) {
+// Bulk copy of framebuffer memory. Only ever called with dst below src or
+// on non-overlapping ranges, so a forward copy is always safe.
+static void fb_copy_bulk(volatile void *dst, const volatile void *src, size_t bytes) {
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    void *d = (void *)dst;
+    const void *s = (const void *)src;
+    size_t qwords = bytes / 8;
+    size_t rest = bytes % 8;
+    __asm__ volatile ("rep movsq" : "+D"(d), "+S"(s), "+c"(qwords) : : "memory");
+    __asm__ volatile ("rep movsb" : "+D"(d), "+S"(s), "+c"(rest) : : "memory");
+#else
+    volatile uint8_t *d = dst;
+    const volatile uint8_t *s = src;
+    for (size_t i = 0; i < bytes; i++) {
+        d[i] = s[i];
+    }
+#endif
+}
+
+static inline void fb_mark_dirty(struct flanterm_fb_context *ctx, size_t y0, size_t y1) {
+    if (ctx->dirty_y0 >= ctx->dirty_y1) {
+        ctx->dirty_y0 = y0;
+        ctx->dirty_y1 = y1;
+        return;
+    }
+    if (y0 < ctx->dirty_y0) {
+        ctx->dirty_y0 = y0;
+    }
+    if (y1 > ctx->dirty_y1) {
+        ctx->dirty_y1 = y1;
+    }
+}
+
+static void plot_cell(struct flanterm_context *_ctx, struct flanterm_fb_char *c, size_t x, size_t y) {
+    struct flanterm_fb_context *ctx = (void *)_ctx;
+
+    ctx->plot_char(_ctx, c, x, y);
+    size_t py = ctx->offset_y + y * ctx->glyph_height;
+    fb_mark_dirty(ctx, py, py + ctx->glyph_height);
+}
+
+// Push the rows drawn into the shadow since the last call to the screen.
+// The copy reads RAM and only writes the framebuffer.
+static void flanterm_fb_present(struct flanterm_context *_ctx) {
     struct flanterm_fb_context *ctx = (void *)_ctx;
 
-    for (size_t i = (_ctx->scroll_bottom_margin - 1) * _ctx->cols - 1;
-         i >= _ctx->scroll_top_margin * _ctx->cols; i--) {
-        if (i == (size_t)-1) {
-            break;
+    size_t y0 = ctx->dirty_y0, y1 = ctx->dirty_y1;
+    ctx->dirty_y0 = ctx->dirty_y1 = 0;
+    if (ctx->scanout == NULL || y0 >= y1) {
+        return;
+    }
+    if (y1 > ctx->height) {
+        y1 = ctx->height;
+    }
+
+    if (ctx->present != NULL) {
+        ctx->present(ctx->present_arg, y0, y1);
+        return;
+    }
+    fb_copy_bulk((volatile uint8_t *)ctx->scanout + y0 * ctx->pitch,
+                 (volatile uint8_t *)ctx->framebuffer + y0 * ctx->pitch,
+                 (y1 - y0) * ctx->pitch);
+}
+
+static void flanterm_fb_flush_queue(struct flanterm_context *_ctx) {
+    struct flanterm_fb_context *ctx = (void *)_ctx;
+
+    for (size_t i = 0; i < ctx->queue_i; i++) {
+        struct flanterm_fb_queue_item *q = &ctx->queue[i];
+        size_t offset = q->y * _ctx->cols + q->x;
+        if (ctx->map[offset] == NULL) {
+            continue;
         }
-        struct flanterm_fb_char *c;
-        struct flanterm_fb_queue_item *q = ctx->map[i];
-        if (q != NULL) {
-            c = &q->c;
-        } else {
-            c = &ctx->grid[i];
+        plot_cell(_ctx, &q->c, q->x, q->y);
+        ctx->grid[offset] = q->c;
+        ctx->map[offset] = NULL;
+    }
+
+    ctx->queue_i = 0;
+}
+
+// Move the scroll region one text line up (or down) by shifting the pixels
+// directly, instead of re-queueing and re-plotting every cell. The pending
+// queue is flushed first so the framebuffer and the grid agree, then both
+// are shifted together. With a shadow the move happens in RAM and the
+// region is pushed out write-only on the next present. Falls back when a
+// canvas is in use, since the background image must stay in place.
+static bool flanterm_fb_fast_scroll(struct flanterm_context *_ctx, bool up) {
+    struct flanterm_fb_context *ctx = (void *)_ctx;
+
+    size_t top = _ctx->scroll_top_margin;
+    size_t bottom = _ctx->scroll_bottom_margin;
+
+    if (ctx->canvas != NULL || bottom > _ctx->rows || bottom <= top + 1) {
+        return false;
+    }
+
+    flanterm_fb_flush_queue(_ctx);
+
+    // Undo the inverted cursor cell so it does not travel with the pixels.
+    if (ctx->old_cursor_x < _ctx->cols && ctx->old_cursor_y < _ctx->rows) {
+        plot_cell(_ctx, &ctx->grid[ctx->old_cursor_x + ctx->old_cursor_y * _ctx->cols],
+                  ctx->old_cursor_x, ctx->old_cursor_y);
+    }
+
+    size_t line_bytes = ctx->glyph_height * ctx->pitch;
+    size_t lines = bottom - top - 1;
+    volatile uint8_t *base = (volatile uint8_t *)ctx->framebuffer + (ctx->offset_y + top * ctx->glyph_height) * ctx->pitch;
+    struct flanterm_fb_char *grid = &ctx->grid[top * _ctx->cols];
+
+    if (up) {
+        fb_copy_bulk(base, base + line_bytes, lines * line_bytes);
+        memmove(grid, grid + _ctx->cols, lines * _ctx->cols * sizeof(struct flanterm_fb_char));
+    } else {
+        // Overlapping move towards higher addresses: go one pixel row at a
+        // time from the bottom so each row copy stays forward.
+        for (size_t r = lines * ctx->glyph_height; r-- > 0;) {
+            fb_copy_bulk(base + line_bytes + r * ctx->pitch, base + r * ctx->pitch, ctx->pitch);
+        }
+        memmove(grid + _ctx->cols, grid, lines * _ctx->cols * sizeof(struct flanterm_fb_char));
+    }
+
+    size_t py = ctx->offset_y + top * ctx->glyph_height;
+    fb_mark_dirty(ctx, py, py + (lines + 1) * ctx->glyph_height);
+    return true;
+}
+
+static void flanterm_fb_revscroll(struct flanterm_context *_ctx) {
+    struct flanterm_fb_context *ctx = (void *)_ctx;
+
+    if (!flanterm_fb_fast_scroll(_ctx, false)) {
+        for (size_t i = (_ctx->scroll_bottom_margin - 1) * _ctx->cols - 1;
+             i >= _ctx->scroll_top_margin * _ctx->cols; i--) {
+            if (i == (size_t)-1) {
+                break;
+            }
+            struct flanterm_fb_char *c;
+            struct flanterm_fb_queue_item *q = ctx->map[i];
+            if (q != NULL) {
+                c = &q->c;
+            } else {
+                c = &ctx->grid[i];
+            }
+            push_to_queue(_ctx, c, (i + _ctx->cols) % _ctx->cols, (i + _ctx->cols) / _ctx->cols);
         }
-        push_to_queue(_ctx, c, (i + _ctx->cols) % _ctx->cols, (i + _ctx->cols) / _ctx->cols);
     }
 
     // Clear the first line of the screen.
@@ -638,16 +768,18 @@ static void flanterm_fb_revscroll(struct flanterm_context *_ctx) {
 static void flanterm_fb_scroll(struct flanterm_context *_ctx) {
     struct flanterm_fb_context *ctx = (void *)_ctx;
 
-    for (size_t i = (_ctx->scroll_top_margin + 1) * _ctx->cols;
-         i < _ctx->scroll_bottom_margin * _ctx->cols; i++) {
-        struct flanterm_fb_char *c;
-        struct flanterm_fb_queue_item *q = ctx->map[i];
-        if (q != NULL) {
-            c = &q->c;
-        } else {
-            c = &ctx->grid[i];
+    if (!flanterm_fb_fast_scroll(_ctx, true)) {
+        for (size_t i = (_ctx->scroll_top_margin + 1) * _ctx->cols;
+             i < _ctx->scroll_bottom_margin * _ctx->cols; i++) {
+            struct flanterm_fb_char *c;
+            struct flanterm_fb_queue_item *q = ctx->map[i];
+            if (q != NULL) {
+                c = &q->c;
+            } else {
+                c = &ctx->grid[i];
+            }
+            push_to_queue(_ctx, c, (i - _ctx->cols) % _ctx->cols, (i - _ctx->cols) / _ctx->cols);
         }
-        push_to_queue(_ctx, c, (i - _ctx->cols) % _ctx->cols, (i - _ctx->cols) / _ctx->cols);
     }
 
     // Clear the last line of the screen.
@@ -805,7 +937,7 @@ static void draw_cursor(struct flanterm_context *_ctx) {
     uint32_t tmp = c.fg;
     c.fg = c.bg;
     c.bg = tmp;
-    ctx->plot_char(_ctx, &c, ctx->cursor_x, ctx->cursor_y);
+    plot_cell(_ctx, &c, ctx->cursor_x, ctx->cursor_y);
     if (q != NULL) {
         ctx->grid[i] = q->c;
         ctx->map[i] = NULL;
@@ -819,27 +951,18 @@ static void flanterm_fb_double_buffer_flush(struct flanterm_context *_ctx) {
         draw_cursor(_ctx);
     }
 
-    for (size_t i = 0; i < ctx->queue_i; i++) {
-        struct flanterm_fb_queue_item *q = &ctx->queue[i];
-        size_t offset = q->y * _ctx->cols + q->x;
-        if (ctx->map[offset] == NULL) {
-            continue;
-        }
-        ctx->plot_char(_ctx, &q->c, q->x, q->y);
-        ctx->grid[offset] = q->c;
-        ctx->map[offset] = NULL;
-    }
+    flanterm_fb_flush_queue(_ctx);
 
     if ((ctx->old_cursor_x != ctx->cursor_x || ctx->old_cursor_y != ctx->cursor_y) || _ctx->cursor_enabled == false) {
         if (ctx->old_cursor_x < _ctx->cols && ctx->old_cursor_y < _ctx->rows) {
-            ctx->plot_char(_ctx, &ctx->grid[ctx->old_cursor_x + ctx->old_cursor_y * _ctx->cols], ctx->old_cursor_x, ctx->old_cursor_y);
+            plot_cell(_ctx, &ctx->grid[ctx->old_cursor_x + ctx->old_cursor_y * _ctx->cols], ctx->old_cursor_x, ctx->old_cursor_y);
         }
     }
 
     ctx->old_cursor_x = ctx->cursor_x;
     ctx->old_cursor_y = ctx->cursor_y;
 
-    ctx->queue_i = 0;
+    flanterm_fb_present(_ctx);
 }
 
 static void flanterm_fb_raw_putchar(struct flanterm_context *_ctx, uint8_t c) {
@@ -883,12 +1006,15 @@ static void flanterm_fb_full_refresh(struct flanterm_context *_ctx) {
         size_t x = i % _ctx->cols;
         size_t y = i / _ctx->cols;
 
-        ctx->plot_char(_ctx, &ctx->grid[i], x, y);
+        plot_cell(_ctx, &ctx->grid[i], x, y);
     }
 
     if (_ctx->cursor_enabled) {
         draw_cursor(_ctx);
     }
+
+    fb_mark_dirty(ctx, 0, ctx->height);
+    flanterm_fb_present(_ctx);
 }
 
 static void flanterm_fb_deinit(struct flanterm_context *_ctx, void (*_free)(void *, size_t)) {
@@ -1251,3 +1377,27 @@ fail:
 
     return NULL;
 }
+
+void flanterm_fb_set_framebuffer(struct flanterm_context *_ctx, uint32_t *framebuffer, uint32_t *shadow) {
+    struct flanterm_fb_context *ctx = (void *)_ctx;
+
+    if (shadow == NULL) {
+        ctx->framebuffer = framebuffer;
+        ctx->scanout = NULL;
+        return;
+    }
+
+    // Rebuild the shadow from the grid rather than reading the old mapping
+    flanterm_fb_flush_queue(_ctx);
+    ctx->framebuffer = shadow;
+    ctx->scanout = framebuffer;
+    flanterm_fb_full_refresh(_ctx);
+}
+
+void flanterm_fb_set_present(struct flanterm_context *_ctx,
+                             void (*present)(void *arg, size_t y0, size_t y1), void *arg) {
+    struct flanterm_fb_context *ctx = (void *)_ctx;
+
+    ctx->present = present;
+    ctx->present_arg = arg;
+}
@@ -0,0 +1,209 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arch/x86_64/syscalls.h>
+#include <arch/x86_64/apic/apic.h>
+
+#include <hardware/memory/pmm.h>
+#include <hardware/memory/paging.h>
+#include <hardware/memory/heap.h>
+
+#include <system/io/ioring.h>
+#include <system/multitasking/tasksched.h>
+
+typedef struct IoRingTimeout {
+    IoRing  *ring;
+    uint64_t user_data;
+} IoRingTimeout;
+
+static IoRing *sqpoll_list = NULL;
+static int sqpoll_timer_armed = 0;
+
+static void ioring_post(IoRing *ring, uint64_t user_data, int64_t res)
+{
+    IoRingShared *sh = ring->shared;
+    uint32_t tail = ring->cq_tail;
+    uint32_t head = __atomic_load_n(&sh->cq_head, __ATOMIC_ACQUIRE);
+
+    // A bogus cq_head only costs the owner its completions
+    if (tail - head >= ring->cq_entries) {
+        sh->cq_overflow++;
+        return;
+    }
+
+    IoRingCqe *cqe = &ring->cqes[tail & (ring->cq_entries - 1)];
+    cqe->user_data = user_data;
+    cqe->res = res;
+    ring->cq_tail = tail + 1;
+    __atomic_store_n(&sh->cq_tail, ring->cq_tail, __ATOMIC_RELEASE);
+}
+
+static void ioring_timeout_fired(void *arg)
+{
+    IoRingTimeout *t = arg;
+    ioring_post(t->ring, t->user_data, 0);
+    __atomic_fetch_sub(&t->ring->in_flight, 1, __ATOMIC_RELEASE);
+    kfree(t);
+}
+
+static void ioring_issue(IoRing *ring, const IoRingSqe *sqe)
+{
+    switch (sqe->opcode) {
+    case IORING_OP_NOP:
+        ioring_post(ring, sqe->user_data, 0);
+        break;
+
+    case IORING_OP_WRITE: {
+        int64_t res = kernel_write(ring->cr3, (uint64_t)sqe->fd, (const char *)sqe->addr, sqe->len);
+        ioring_post(ring, sqe->user_data, res < 0 ? -IORING_EFAULT : res);
+    } break;
+
+    case IORING_OP_TIMEOUT: {
+        IoRingTimeout *t = kmalloc(sizeof(IoRingTimeout));
+        if (!t) {
+            ioring_post(ring, sqe->user_data, -IORING_EBUSY);
+            break;
+        }
+        t->ring = ring;
+        t->user_data = sqe->user_data;
+        __atomic_fetch_add(&ring->in_flight, 1, __ATOMIC_RELAXED);
+        timer_register(sqe->len, ioring_timeout_fired, t);
+    } break;
+
+    default:
+        ioring_post(ring, sqe->user_data, -IORING_EINVAL);
+        break;
+    }
+}
+
+static uint32_t ioring_submit(IoRing *ring, uint32_t max)
+{
+    IoRingShared *sh = ring->shared;
+    uint32_t tail = __atomic_load_n(&sh->sq_tail, __ATOMIC_ACQUIRE);
+    uint32_t done = 0;
+
+    // Never more than one ring's worth per call, whatever sq_tail claims
+    if (max > ring->sq_entries)
+        max = ring->sq_entries;
+
+    while (ring->sq_head != tail && done < max) {
+        IoRingSqe sqe = ring->sqes[ring->sq_head & (ring->sq_entries - 1)];
+        ring->sq_head++;
+        __atomic_store_n(&sh->sq_head, ring->sq_head, __ATOMIC_RELEASE);
+        ioring_issue(ring, &sqe);
+        done++;
+    }
+    return done;
+}
+
+/* Stand-in for a dedicated poller thread: drain SQPOLL rings every tick */
+static void ioring_sqpoll_timer(void *unused)
+{
+    (void)unused;
+    for (IoRing *ring = sqpoll_list; ring; ring = ring->next_poll) {
+        if (ring->owner->main_thread && ring->owner->main_thread->state == THREAD_STATE_DONE)
+            continue;
+        ioring_submit(ring, ring->sq_entries);
+    }
+    timer_register(IORING_POLL_MS, ioring_sqpoll_timer, NULL);
+}
+
+int64_t ioring_setup(Process *proc, uint32_t entries, uint32_t flags)
+{
+    if (proc->ioring)
+        return -IORING_EBUSY;
+    if (entries == 0 || entries > IORING_MAX_ENTRIES || (entries & (entries - 1)))
+        return -IORING_EINVAL;
+    if (flags & ~IORING_SETUP_SQPOLL)
+        return -IORING_EINVAL;
+
+    uint32_t cq_entries = entries * 2;
+    size_t cqes_offset = IORING_SQES_OFFSET + entries * sizeof(IoRingSqe);
+    size_t bytes = cqes_offset + cq_entries * sizeof(IoRingCqe);
+    size_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    uintptr_t phys = alloc_pages(pages);
+    if (!phys)
+        return -IORING_EBUSY;
+
+    IoRing *ring = kmalloc(sizeof(IoRing));
+    if (!ring) {
+        for (size_t i = 0; i < pages; i++)
+            free_page(phys + i * PAGE_SIZE);
+        return -IORING_EBUSY;
+    }
+
+    uint8_t *base = virt_addr(phys);
+    memset(base, 0, pages * PAGE_SIZE);
+
+    ring->owner = proc;
+    ring->cr3 = proc->cr3;
+    ring->shared = (IoRingShared *)base;
+    ring->sqes = (IoRingSqe *)(base + IORING_SQES_OFFSET);
+    ring->cqes = (IoRingCqe *)(base + cqes_offset);
+    ring->sq_entries = entries;
+    ring->cq_entries = cq_entries;
+    ring->sq_head = 0;
+    ring->cq_tail = 0;
+    ring->in_flight = 0;
+    ring->flags = flags;
+    ring->next_poll = NULL;
+
+    ring->shared->sq_entries = entries;
+    ring->shared->cq_entries = cq_entries;
+    ring->shared->flags = flags;
+    ring->shared->sqes_offset = IORING_SQES_OFFSET;
+    ring->shared->cqes_offset = (uint32_t)cqes_offset;
+
+    for (size_t i = 0; i < pages; i++) {
+        mapPage_in_pml4(proc->cr3, (void *)(IORING_USER_ADDR + i * PAGE_SIZE),
+                        (void *)(phys + i * PAGE_SIZE),
+                        PG_PRESENT | PG_WRITABLE | PG_USER | PG_NX);
+    }
+
+    proc->ioring = ring;
+
+    if (flags & IORING_SETUP_SQPOLL) {
+        ring->next_poll = sqpoll_list;
+        sqpoll_list = ring;
+        if (!sqpoll_timer_armed) {
+            sqpoll_timer_armed = 1;
+            timer_register(IORING_POLL_MS, ioring_sqpoll_timer, NULL);
+        }
+    }
+
+    return (int64_t)IORING_USER_ADDR;
+}
+
+int64_t ioring_enter(Process *proc, uint32_t to_submit, uint32_t min_complete)
+{
+    IoRing *ring = proc->ioring;
+    if (!ring)
+        return -IORING_EINVAL;
+
+    uint32_t submitted = ioring_submit(ring, to_submit);
+
+    if (min_complete > ring->cq_entries)
+        min_complete = ring->cq_entries;
+
+    // Wait only for completions that can still arrive
+    uint32_t ready = ring->cq_tail - __atomic_load_n(&ring->shared->cq_head, __ATOMIC_ACQUIRE);
+    uint32_t reachable = ready + __atomic_load_n(&ring->in_flight, __ATOMIC_ACQUIRE);
+    if (min_complete > reachable)
+        min_complete = reachable;
+
+    // Syscalls run with IF masked; let the timer deliver pending completions.
+    // The timer cannot preempt us here, so never halt on a wait that reaping
+    // or a CQ overflow has made impossible.
+    for (;;) {
+        ready = ring->cq_tail - __atomic_load_n(&ring->shared->cq_head, __ATOMIC_ACQUIRE);
+        if (ready >= min_complete)
+            break;
+        if (ready + __atomic_load_n(&ring->in_flight, __ATOMIC_ACQUIRE) < min_complete)
+            return -IORING_EAGAIN;
+        __asm__ volatile("sti; hlt; cli");
+    }
+
+    return submitted;
+}
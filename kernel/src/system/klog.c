@@ -0,0 +1,294 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/percpu.h>
+
+#include <system/klog.h>
+#include <system/term.h>
+#include <system/multitasking/softirq.h>
+
+_Static_assert(sizeof(KlogRecord) == 128, "KlogRecord size");
+_Static_assert((KLOG_RECORDS & (KLOG_RECORDS - 1)) == 0, "KLOG_RECORDS power of two");
+_Static_assert((KLOG_HISTORY & (KLOG_HISTORY - 1)) == 0, "KLOG_HISTORY power of two");
+
+/*
+ * One single-producer ring per CPU. Producers on a CPU can still nest
+ * (thread, IRQ, NMI), so a slot is claimed with a CAS on head and published
+ * by writing its seq last. The consumer drains from tail, merging CPUs in
+ * TSC order, and stops at the first unpublished slot.
+ */
+typedef struct KlogRing {
+    volatile uint64_t head;
+    volatile uint64_t tail;
+    volatile uint64_t dropped;
+    KlogRecord rec[KLOG_RECORDS];
+} KlogRing;
+
+static KlogRing klog_rings[MAX_CPUS];
+
+static bool klog_async = false;
+static int console_level = KLOG_INFO;
+static volatile int consumer_cpu = -1;
+
+// Until percpu_init_bsp() GS is not usable and only the BSP is running
+static inline int klog_cpu(void)
+{
+    return percpu[0].online ? (int)current_cpu_id() : 0;
+}
+
+static bool klog_put(KlogRing *ring, int cpu, int level, uint64_t tsc,
+                     const char *s, size_t len)
+{
+    uint64_t h;
+    do {
+        h = ring->head;
+        if (h - ring->tail >= KLOG_RECORDS)
+            return false;
+    } while (!__atomic_compare_exchange_n(&ring->head, &h, h + 1, false,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    KlogRecord *r = &ring->rec[h & (KLOG_RECORDS - 1)];
+    r->tsc = tsc;
+    r->len = (uint16_t)len;
+    r->level = (uint8_t)level;
+    r->cpu = (uint8_t)cpu;
+    memcpy(r->text, s, len);
+    __atomic_store_n(&r->seq, h + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*
+ * A full ring is drained in place by thread and softirq producers. Hard IRQ
+ * and NMI producers may have interrupted the console (and its locks) on
+ * this CPU, as may a producer nested inside this CPU's own drain, so those
+ * drop instead.
+ */
+static bool klog_put_wait(KlogRing *ring, int cpu, int level, uint64_t tsc,
+                          const char *s, size_t len)
+{
+    while (!klog_put(ring, cpu, level, tsc, s, len)) {
+        if (percpu[0].online && this_cpu()->in_irq)
+            return false;
+        if (__atomic_load_n(&consumer_cpu, __ATOMIC_ACQUIRE) == cpu)
+            return false;
+        klog_flush();
+        __asm__ volatile("pause");
+    }
+    return true;
+}
+
+/*
+ * Producer side: copy into this CPU's ring, draining it only when full.
+ * Returns the bytes stored; once a record is dropped the rest of the write
+ * is dropped too, so what was stored is always a prefix of s.
+ */
+size_t klog_write(int level, const char *s, size_t len)
+{
+    int cpu = klog_cpu();
+    KlogRing *ring = &klog_rings[cpu];
+    uint64_t tsc = rdtsc();
+    size_t stored = 0;
+
+    while (stored < len) {
+        size_t chunk = len - stored < KLOG_TEXT ? len - stored : KLOG_TEXT;
+        if (!klog_put_wait(ring, cpu, level, tsc, s + stored, chunk)) {
+            __atomic_fetch_add(&ring->dropped, (len - stored + KLOG_TEXT - 1) / KLOG_TEXT,
+                               __ATOMIC_RELAXED);
+            break;
+        }
+        stored += chunk;
+    }
+
+    if (klog_async)
+        raise_softirq(SOFTIRQ_CONSOLE);
+    else
+        klog_flush();
+    return stored;
+}
+
+int klog_printf(int level, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap; va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    klog_write(level, buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+    return n;
+}
+
+void klog_set_console_level(int level)
+{
+    console_level = level;
+}
+
+// Oldest published record across all rings, or NULL
+static KlogRing *klog_next(void)
+{
+    KlogRing *best = NULL;
+    uint64_t best_tsc = 0;
+
+    for (int c = 0; c < MAX_CPUS; c++) {
+        KlogRing *ring = &klog_rings[c];
+        uint64_t t = ring->tail;
+        if (t == ring->head)
+            continue;
+        KlogRecord *r = &ring->rec[t & (KLOG_RECORDS - 1)];
+        if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != t + 1)
+            continue;
+        if (!best || r->tsc < best_tsc) {
+            best = ring;
+            best_tsc = r->tsc;
+        }
+    }
+    return best;
+}
+
+// Records are coalesced here so the console sees few, large writes
+static char batch[KLOG_BATCH];
+static size_t batch_len;
+
+static void batch_flush(void)
+{
+    if (batch_len)
+        term_write_n(batch, batch_len);
+    batch_len = 0;
+}
+
+static void batch_add(const char *s, size_t len)
+{
+    if (batch_len + len > sizeof(batch))
+        batch_flush();
+    memcpy(batch + batch_len, s, len);
+    batch_len += len;
+}
+
+/*
+ * Consumed records, oldest overwritten first, kept for SYS_KLOG_READ. Only
+ * the console owner appends; history_seq is odd while a slot is being
+ * rewritten so readers can retry a torn copy.
+ */
+static KlogRecord history[KLOG_HISTORY];
+static volatile uint64_t history_head;
+static volatile uint64_t history_seq;
+static bool mid_line[MAX_CPUS];
+
+static void history_add(const KlogRecord *r)
+{
+    KlogRecord *h = &history[history_head & (KLOG_HISTORY - 1)];
+
+    __atomic_store_n(&history_seq, history_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    *h = *r;
+    h->flags = mid_line[r->cpu] ? 0 : KLOG_F_LINE_START;
+    __atomic_store_n(&history_head, history_head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&history_seq, history_seq + 1, __ATOMIC_RELEASE);
+
+    mid_line[r->cpu] = r->len && r->text[r->len - 1] != '\n';
+}
+
+/*
+ * Format history from *cursor on as "<level>[sec.usec] text", the prefix
+ * only at line starts. Copies whole records, advances *cursor past them and
+ * returns the bytes written. A cursor that fell behind skips ahead to the
+ * oldest record still kept.
+ */
+size_t klog_read_history(uint64_t *cursor, char *buf, size_t size)
+{
+    uint64_t tsc_per_us = frequency_tsc_per_sec / 1000000;
+    size_t out = 0;
+
+    for (;;) {
+        KlogRecord r;
+        uint64_t seq;
+        do {
+            seq = __atomic_load_n(&history_seq, __ATOMIC_ACQUIRE);
+            uint64_t head = __atomic_load_n(&history_head, __ATOMIC_ACQUIRE);
+            if (*cursor > head || head - *cursor > KLOG_HISTORY)
+                *cursor = head > KLOG_HISTORY ? head - KLOG_HISTORY : 0;
+            if (*cursor >= head)
+                return out;
+            r = history[*cursor & (KLOG_HISTORY - 1)];
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        } while ((seq & 1) || seq != __atomic_load_n(&history_seq, __ATOMIC_ACQUIRE));
+
+        char prefix[48];
+        size_t plen = 0;
+        if (r.flags & KLOG_F_LINE_START) {
+            uint64_t us = tsc_per_us ? r.tsc / tsc_per_us : 0;
+            plen = (size_t)snprintf(prefix, sizeof(prefix), "<%u>[%5llu.%06llu] ",
+                                    (unsigned)r.level, us / 1000000, us % 1000000);
+        }
+        if (out + plen + r.len > size)
+            return out;
+
+        memcpy(buf + out, prefix, plen);
+        memcpy(buf + out + plen, r.text, r.len);
+        out += plen + r.len;
+        (*cursor)++;
+    }
+}
+
+// Only the console owner (consumer_cpu) may call this
+static void klog_drain(void)
+{
+    KlogRing *ring;
+    while ((ring = klog_next())) {
+        uint64_t t = ring->tail;
+        KlogRecord *r = &ring->rec[t & (KLOG_RECORDS - 1)];
+
+        if (r->level <= console_level)
+            batch_add(r->text, r->len);
+        history_add(r);
+        __atomic_store_n(&ring->tail, t + 1, __ATOMIC_RELEASE);
+
+        uint64_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+            char note[64];
+            int n = snprintf(note, sizeof(note), "\n[ KLOG ] %llu messages dropped\n", dropped);
+            batch_add(note, (size_t)n);
+        }
+    }
+    batch_flush();
+}
+
+// Drain to the console unless another CPU is already doing it
+void klog_flush(void)
+{
+    int cpu = klog_cpu();
+    int expected = -1;
+    if (!__atomic_compare_exchange_n(&consumer_cpu, &expected, cpu, false,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    klog_drain();
+    __atomic_store_n(&consumer_cpu, -1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Before halting: take the console even if the interrupted context on this
+ * CPU held it, print everything, and stay synchronous from here on.
+ */
+void klog_panic(void)
+{
+    klog_async = false;
+    __atomic_store_n(&consumer_cpu, klog_cpu(), __ATOMIC_RELEASE);
+    batch_len = 0;  // an interrupted drain may have left a partial batch
+    klog_drain();
+    __atomic_store_n(&consumer_cpu, -1, __ATOMIC_RELEASE);
+}
+
+static void klog_softirq(void)
+{
+    klog_flush();
+}
+
+// Needs softirqs; until then every write drains synchronously
+void klog_init(void)
+{
+    open_softirq(SOFTIRQ_CONSOLE, klog_softirq);
+    klog_async = true;
+}
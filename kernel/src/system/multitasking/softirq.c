@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/percpu.h>
+
+#include <system/multitasking/softirq.h>
+#include <system/multitasking/tasksched.h>
+
+static softirq_fn_t softirq_vec[SOFTIRQ_COUNT];
+
+// Raised before the per-CPU area exists; folded into BSP state by softirq_init()
+static volatile uint32_t early_pending = 0;
+static bool softirq_online = false;
+
+void open_softirq(int nr, softirq_fn_t fn)
+{
+    softirq_vec[nr] = fn;
+}
+
+// Safe from hard IRQ context: the pending mask is only touched by its own CPU
+void raise_softirq(int nr)
+{
+    if (!softirq_online) {
+        __atomic_fetch_or(&early_pending, 1u << nr, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_or(&this_cpu()->softirq_pending, 1u << nr, __ATOMIC_RELAXED);
+}
+
+bool in_softirq(void)
+{
+    return softirq_online && this_cpu()->in_softirq;
+}
+
+/*
+ * Run pending softirqs with interrupts enabled until nothing is pending or
+ * the budget (rounds and time) is used up. Called and returns with
+ * interrupts disabled.
+ */
+static void do_softirq(PerCpu* cpu)
+{
+    uint64_t deadline = rdtsc() + frequency_tsc_per_sec / 1000000 * SOFTIRQ_MAX_US;
+    int restart = SOFTIRQ_MAX_RESTART;
+    uint32_t pending;
+
+    cpu->in_softirq++;
+    while ((pending = __atomic_exchange_n(&cpu->softirq_pending, 0, __ATOMIC_ACQUIRE))) {
+        __asm__ volatile("sti" ::: "memory");
+        while (pending) {
+            int nr = __builtin_ctz(pending);
+            pending &= pending - 1;
+            if (softirq_vec[nr])
+                softirq_vec[nr]();
+        }
+        __asm__ volatile("cli" ::: "memory");
+
+        if (--restart == 0 || (frequency_tsc_per_sec && rdtsc() > deadline))
+            break;
+    }
+    cpu->in_softirq--;
+}
+
+static void wake_ksoftirqd(PerCpu* cpu)
+{
+    Thread* t = cpu->ksoftirqd;
+    if (t && t->state == THREAD_STATE_BLOCKED)
+        t->state = THREAD_STATE_READY;
+}
+
+// Called by irqHandler after EOI, interrupts still disabled
+void softirq_irq_exit(void)
+{
+    if (!softirq_online)
+        return;
+
+    PerCpu* cpu = this_cpu();
+    if (cpu->in_softirq || !cpu->softirq_pending)
+        return;
+
+    do_softirq(cpu);
+
+    // Overloaded: let the scheduler interleave the rest with normal threads
+    if (cpu->softirq_pending)
+        wake_ksoftirqd(cpu);
+}
+
+/*
+ * Kernel threads restart from their entry point whenever they are scheduled,
+ * so this loop keeps no state across iterations. Preemption is held off
+ * while a batch runs (in_softirq), never in between.
+ */
+static void ksoftirqd_loop(void)
+{
+    PerCpu* cpu = this_cpu();
+    for (;;) {
+        __asm__ volatile("cli" ::: "memory");
+        if (cpu->softirq_pending) {
+            cpu->ksoftirqd->state = THREAD_STATE_RUNNING;
+            do_softirq(cpu);
+            __asm__ volatile("sti" ::: "memory");
+            continue;
+        }
+        // Nothing left: park until an IRQ exit runs out of budget again
+        cpu->ksoftirqd->state = THREAD_STATE_BLOCKED;
+        __asm__ volatile("sti; hlt" ::: "memory");
+    }
+}
+
+static void tasklet_action(void)
+{
+    PerCpu* cpu = this_cpu();
+
+    uint64_t flags = irq_save();
+    Tasklet* list = cpu->tasklets;
+    cpu->tasklets = NULL;
+    irq_restore(flags);
+
+    while (list) {
+        Tasklet* t = list;
+        list = t->next;
+        t->scheduled = 0;
+        t->func(t->data);
+    }
+}
+
+void tasklet_init(Tasklet* t, void (*func)(void*), void* data)
+{
+    t->next = NULL;
+    t->func = func;
+    t->data = data;
+    t->scheduled = 0;
+}
+
+void tasklet_schedule(Tasklet* t)
+{
+    if (!softirq_online) {
+        t->func(t->data);
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    if (!t->scheduled) {
+        PerCpu* cpu = this_cpu();
+        t->scheduled = 1;
+        t->next = cpu->tasklets;
+        cpu->tasklets = t;
+        raise_softirq(SOFTIRQ_TASKLET);
+    }
+    irq_restore(flags);
+}
+
+// Needs the per-CPU area and the scheduler's thread list
+void softirq_init(void)
+{
+    PerCpu* cpu = this_cpu();
+
+    open_softirq(SOFTIRQ_TASKLET, tasklet_action);
+
+    cpu->ksoftirqd = create_kernel_thread(ksoftirqd_loop, THREAD_PRIORITY_HIGH);
+    if (cpu->ksoftirqd)
+        cpu->ksoftirqd->state = THREAD_STATE_BLOCKED;
+
+    uint64_t flags = irq_save();
+    cpu->softirq_pending |= __atomic_exchange_n(&early_pending, 0, __ATOMIC_RELAXED);
+    softirq_online = true;
+    irq_restore(flags);
+
+    printf("[ SOFTIRQ ] ksoftirqd TID %llu\n", cpu->ksoftirqd ? cpu->ksoftirqd->tid : 0);
+}
@@ -2,14 +2,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/percpu.h>
+
 #include <hardware/memory/pmm.h>
 #include <hardware/memory/paging.h>
 
+#include <drivers/video/compositor.h>
+
 #include <system/multitasking/tasksched.h>
 #include <system/exec/elf_loader.h>
 #include <system/exec/user.h>
 #include <system/exec/elf64/ehdr64.h>
 #include <system/exec/elf64/phdr64.h>
+#include <system/time/vclock.h>
 
 Thread* current_thread = NULL;
 int scheduler_running = 0;
@@ -21,7 +27,7 @@ static uint64_t next_pid = 1;
 
 extern uintptr_t hhdm;
 extern uint64_t create_user_address_space(void);
-extern void mapPage_in_pml4(uint64_t pml4_virt, void *virt, void *phys, uint64_t flags);
+extern bool mapPage_in_pml4(uint64_t pml4_virt, void *virt, void *phys, uint64_t flags);
 
 extern uint8_t *kernel_stack_top;
 extern uint8_t kernel_stack[];
@@ -49,7 +55,7 @@ void task_trampoline(void) {
     }
     
     if (current_thread->context.cr3) {
-        __asm__ volatile("mov %0, %%cr3" : : "r"(current_thread->context.cr3) : "memory");
+        percpu_set_cr3(current_thread->context.cr3);
     }
     
     current_thread->in_userspace = 1;
@@ -72,6 +78,7 @@ void scheduler_init(void) {
     idle.context.rip = (uint64_t)idle_loop;
     idle.context.rsp = (uint64_t)kernel_stack_top;
     idle.context.rflags = 0x202;
+    idle.context.cr3 = kernel_cr3_phys;
     idle.next = NULL;
     
     thread_list = &idle;
@@ -97,6 +104,7 @@ Thread* schedule(void) {
                 printf("[ SCHEDULER ] current_thread->next=%p, tid=%llu\n", 
                        current_thread->next, current_thread->tid);
             }
+            klog_panic();
             for(;;) __asm__ volatile("cli; hlt");
         }
         
@@ -131,6 +139,7 @@ Process* create_process(void* elf_data) {
     proc->thread_list = NULL;
     
     proc->cr3 = create_user_address_space();
+    vclock_map_into(proc->cr3);
     
     ELF64_Hdr_t* eh = (ELF64_Hdr_t*)elf_data;
     ELF64_Phdr_t* ph = (ELF64_Phdr_t*)((uint8_t*)elf_data + eh->e_phoff);
@@ -224,6 +233,44 @@ void finalize_thread_list(void) {
     __asm__ volatile("mfence" ::: "memory");
 }
 
+/*
+ * Kernel threads have no process and run on the shared kernel half. Like the
+ * idle thread they restart at `entry` each time they are scheduled.
+ */
+Thread* create_kernel_thread(void (*entry)(void), int priority) {
+    Thread* thread = malloc(sizeof(Thread));
+    if (!thread)
+        return NULL;
+    memset(thread, 0, sizeof(Thread));
+
+    thread->tid = next_tid++;
+    thread->state = THREAD_STATE_READY;
+    thread->priority = priority;
+    thread->process = NULL;
+
+    uintptr_t kphys = alloc_pages(4);
+    thread->kernel_stack = (void*)(kphys + hhdm);
+    thread->kernel_stack_top = (void*)((uint8_t*)thread->kernel_stack + 4*PAGE_SIZE);
+
+    thread->context.cr3 = kernel_cr3_phys;
+    thread->context.rip = (uint64_t)entry;
+    thread->context.rsp = (uint64_t)thread->kernel_stack_top;
+    thread->context.rflags = 0x202;
+    thread->in_userspace = 0;
+
+    // Insert after the head: valid before and after finalize_thread_list()
+    uint64_t flags = irq_save();
+    if (!thread_list) {
+        thread_list = thread;
+    } else {
+        thread->next = thread_list->next;
+        thread_list->next = thread;
+    }
+    irq_restore(flags);
+
+    return thread;
+}
+
 Thread* create_thread(Process* proc, void* user_stack) {
     Thread* thread = malloc(sizeof(Thread));
     memset(thread, 0, sizeof(Thread));
@@ -267,12 +314,27 @@ Thread* create_thread(Process* proc, void* user_stack) {
     return thread;
 }
 
+// Give back what a dead process holds outside its own address space
+static void process_release(Process* proc) {
+    gfx_surface_release(proc);
+}
+
+// Called as a thread finishes; the last one out releases the process
+void process_thread_exited(Process* proc) {
+    for (Thread* t = proc->thread_list; t; t = t->next_in_process) {
+        if (t->state != THREAD_STATE_DONE)
+            return;
+    }
+    process_release(proc);
+}
+
 void terminate_process(Process* proc, int exit_code) {
     Thread* t = proc->thread_list;
     while (t) {
         t->state = THREAD_STATE_DONE;
         t = t->next_in_process;
     }
+    process_release(proc);
     
     printf("[ PROCESS ] Process %llu exited with exit code %d.\n",
            (unsigned long long)proc->pid, exit_code);
@@ -0,0 +1,292 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/percpu.h>
+#include <arch/x86_64/apic/apic.h>
+
+#include <hardware/devices/serial.h>
+#include <hardware/memory/paging.h>
+#include <hardware/memory/pmm.h>
+
+#include <system/multitasking/tasksched.h>
+#include <system/profile/profiler.h>
+
+#define IA32_PMC0                   0xC1
+#define IA32_PERFEVTSEL0            0x186
+#define IA32_PERF_GLOBAL_STATUS     0x38E
+#define IA32_PERF_GLOBAL_CTRL       0x38F
+#define IA32_PERF_GLOBAL_OVF_CTRL   0x390
+
+#define PERFEVTSEL_USR  (1ULL << 16)
+#define PERFEVTSEL_OS   (1ULL << 17)
+#define PERFEVTSEL_INT  (1ULL << 20)
+#define PERFEVTSEL_EN   (1ULL << 22)
+
+#define LAPIC_LVT_PERF  0x340
+#define LVT_DM_NMI      (4 << 8)
+#define LVT_MASKED      (1 << 16)
+
+typedef struct ProfRing {
+    ProfSample* buf;
+    uint32_t cap;
+    volatile uint64_t head;     // total samples written; slot is head % cap
+} ProfRing;
+
+static ProfRing prof_rings[MAX_CPUS];
+
+static int prof_source = PROF_SRC_NONE;
+static volatile bool prof_running = false;
+static uint64_t prof_period = 0;
+static uint64_t prof_ticks = 0;
+
+// Architectural PMU, copied from cpu_info
+static uint32_t pmu_version = 0;
+static uint32_t pmu_width = 0;
+static uint32_t pmu_unavailable = 0;   // bit set = event not supported
+static uint32_t pmu_events = 0;        // valid bits in pmu_unavailable
+
+extern Thread* current_thread;
+
+static bool pmu_has_event(int event)
+{
+    int bit = event == PROF_EVENT_CYCLES ? 0 : 1;
+    return bit < (int)pmu_events && !(pmu_unavailable & (1u << bit));
+}
+
+static void pmu_detect(void)
+{
+    if (!cpu_has(CPU_FEAT_ARCH_PMU))
+        return;
+
+    pmu_version = cpu_info->pmu_version;
+    pmu_width = cpu_info->pmu_width;
+    pmu_events = cpu_info->pmu_event_len;
+    pmu_unavailable = cpu_info->pmu_events_unavailable;
+}
+
+static uint64_t pmu_reload_value(void)
+{
+    uint64_t mask = pmu_width >= 64 ? ~0ULL : (1ULL << pmu_width) - 1;
+    return (0 - prof_period) & mask;
+}
+
+// Only kernel frames are walked: user memory may fault and NMIs can't take faults
+static uint16_t prof_walk(uint64_t rbp, uint64_t* out)
+{
+    Thread* t = current_thread;
+    if (!t || !rbp)
+        return 0;
+
+    uint64_t lo = (uint64_t)t->kernel_stack;
+    uint64_t hi = (uint64_t)t->kernel_stack_top;
+    uint16_t depth = 0;
+
+    while (depth < PROF_STACK_DEPTH) {
+        if (rbp < lo || rbp + 16 > hi || (rbp & 7))
+            break;
+        uint64_t* fp = (uint64_t*)rbp;
+        if (fp[1] < 0xFFFF800000000000ULL)
+            break;
+        out[depth++] = fp[1];
+        if (fp[0] <= rbp)
+            break;
+        rbp = fp[0];
+    }
+    return depth;
+}
+
+static void prof_record(InterruptFrame* frame, uint64_t rbp)
+{
+    uint32_t cpu = (uint32_t)current_cpu_id();
+    ProfRing* ring = &prof_rings[cpu];
+    if (!ring->buf)
+        return;
+
+    ProfSample* s = &ring->buf[ring->head % ring->cap];
+    s->tsc = rdtsc();
+    s->rip = frame->rip;
+    s->tid = current_thread ? current_thread->tid : 0;
+    s->cpu = cpu;
+    s->user = (frame->cs & 3) != 0;
+    s->depth = s->user ? 0 : prof_walk(rbp, s->stack);
+    ring->head++;
+}
+
+/*
+ * Called first for every NMI. Returns true when the NMI was a PMC0 overflow
+ * and has been consumed; anything else falls through to the exception path.
+ */
+bool profiler_nmi(InterruptFrame* frame, uint64_t rbp)
+{
+    if (prof_source != PROF_SRC_PMU || !prof_running)
+        return false;
+
+    bool overflow;
+    if (pmu_version >= 2)
+        overflow = rdmsr(IA32_PERF_GLOBAL_STATUS) & 1;
+    else
+        overflow = !(rdmsr(IA32_PMC0) & (1ULL << (pmu_width - 1)));
+    if (!overflow)
+        return false;
+
+    prof_record(frame, rbp);
+
+    wrmsr(IA32_PMC0, pmu_reload_value());
+    if (pmu_version >= 2)
+        wrmsr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+    // Delivering the PMI sets the LVT mask bit
+    writeAPICRegister(LAPIC_LVT_PERF, LVT_DM_NMI);
+    return true;
+}
+
+// Fallback source, called from the LAPIC timer interrupt
+void profiler_tick(InterruptFrame* frame)
+{
+    if (prof_source != PROF_SRC_TIMER || !prof_running)
+        return;
+    if (++prof_ticks < prof_period)
+        return;
+    prof_ticks = 0;
+    prof_record(frame, 0);
+}
+
+static void pmu_stop(void)
+{
+    wrmsr(IA32_PERFEVTSEL0, 0);
+    if (pmu_version >= 2)
+        wrmsr(IA32_PERF_GLOBAL_CTRL, rdmsr(IA32_PERF_GLOBAL_CTRL) & ~1ULL);
+    writeAPICRegister(LAPIC_LVT_PERF, LVT_DM_NMI | LVT_MASKED);
+}
+
+static void pmu_start(int event)
+{
+    uint64_t evtsel = event == PROF_EVENT_CYCLES ? 0x3C : 0xC0;
+
+    pmu_stop();
+    wrmsr(IA32_PMC0, pmu_reload_value());
+    writeAPICRegister(LAPIC_LVT_PERF, LVT_DM_NMI);
+    if (pmu_version >= 2) {
+        wrmsr(IA32_PERF_GLOBAL_OVF_CTRL, 1);
+        wrmsr(IA32_PERF_GLOBAL_CTRL, rdmsr(IA32_PERF_GLOBAL_CTRL) | 1);
+    }
+    wrmsr(IA32_PERFEVTSEL0, evtsel | PERFEVTSEL_USR | PERFEVTSEL_OS |
+                            PERFEVTSEL_INT | PERFEVTSEL_EN);
+}
+
+/*
+ * Start sampling on the calling CPU every `period` events (PMU) or timer
+ * ticks (fallback). Restarting keeps the samples already collected.
+ */
+int profiler_start(int event, uint64_t period)
+{
+    if (prof_source == PROF_SRC_NONE || period == 0)
+        return -1;
+
+    profiler_stop();
+    prof_period = period;
+    prof_ticks = 0;
+
+    if (prof_source == PROF_SRC_PMU) {
+        if (!pmu_has_event(event))
+            return -1;
+        // Keep the preload inside the counter width
+        if (pmu_width < 64 && period >= (1ULL << (pmu_width - 1)))
+            return -1;
+        prof_running = true;
+        pmu_start(event);
+    } else {
+        prof_running = true;
+    }
+    return 0;
+}
+
+void profiler_stop(void)
+{
+    prof_running = false;
+    if (prof_source == PROF_SRC_PMU)
+        pmu_stop();
+}
+
+#define PROF_DUMP_CHUNK 1024
+
+static char dump_buf[PROF_DUMP_CHUNK];
+static size_t dump_len;
+
+static void prof_flush(void)
+{
+    serial_write(dump_buf, dump_len);
+    dump_len = 0;
+}
+
+static void prof_emit(const char* line, size_t len)
+{
+    if (dump_len + len > PROF_DUMP_CHUNK)
+        prof_flush();
+    memcpy(dump_buf + dump_len, line, len);
+    dump_len += len;
+}
+
+/*
+ * One line per sample on COM1 so large dumps don't go through the
+ * framebuffer: "prof <cpu> <tid> <tsc> <k|u> <rip> [<ret>,...]", all hex.
+ * Sampling is stopped first so the rings are stable. Lines are batched into
+ * PROF_DUMP_CHUNK pieces and queued through serial_write() with interrupts
+ * on, so the dump shares the TX ring with everything else and a long one
+ * does not hold IF off for the seconds it takes at 38400 baud.
+ */
+void profiler_dump(void)
+{
+    profiler_stop();
+
+    bool was_enabled = are_interrupts_enabled();
+    __asm__ volatile("sti" ::: "memory");
+
+    char line[64 + PROF_STACK_DEPTH * 18];
+    for (int c = 0; c < MAX_CPUS; c++) {
+        ProfRing* ring = &prof_rings[c];
+        if (!ring->buf || !ring->head)
+            continue;
+
+        uint64_t first = ring->head > ring->cap ? ring->head - ring->cap : 0;
+        for (uint64_t i = first; i < ring->head; i++) {
+            ProfSample* s = &ring->buf[i % ring->cap];
+            int len = snprintf(line, sizeof(line), "prof %x %llx %llx %c %llx",
+                               s->cpu, s->tid, s->tsc, s->user ? 'u' : 'k', s->rip);
+            for (uint16_t d = 0; d < s->depth; d++)
+                len += snprintf(line + len, sizeof(line) - len, "%c%llx", d ? ',' : ' ', s->stack[d]);
+            len += snprintf(line + len, sizeof(line) - len, "\r\n");
+            prof_emit(line, (size_t)len);
+        }
+        prof_flush();
+        if (first)
+            printf("[ PROF ] CPU%d: %llu samples overwritten\n", c, first);
+    }
+
+    if (!was_enabled)
+        __asm__ volatile("cli" ::: "memory");
+}
+
+// Needs the per-CPU area and the LAPIC; sets up the calling CPU's ring
+void profiler_init(void)
+{
+    uint32_t cpu = (uint32_t)current_cpu_id();
+    uintptr_t phys = alloc_pages(PROF_RING_PAGES);
+    prof_rings[cpu].buf = (ProfSample*)(phys + hhdm);
+    prof_rings[cpu].cap = PROF_RING_PAGES * PAGE_SIZE / sizeof(ProfSample);
+    prof_rings[cpu].head = 0;
+
+    pmu_detect();
+    if (pmu_version && (pmu_has_event(PROF_EVENT_CYCLES) || pmu_has_event(PROF_EVENT_INSTRUCTIONS))) {
+        prof_source = PROF_SRC_PMU;
+        printf("[ PROF ] PMU v%u, %u-bit counters, %u samples per CPU\n",
+               pmu_version, pmu_width, prof_rings[cpu].cap);
+    } else {
+        prof_source = PROF_SRC_TIMER;
+        printf("[ PROF ] No usable PMU, sampling on the LAPIC timer (%u samples per CPU)\n",
+               prof_rings[cpu].cap);
+    }
+    writeAPICRegister(LAPIC_LVT_PERF, LVT_DM_NMI | LVT_MASKED);
+}
@@ -4,12 +4,18 @@
 
 #include <hardware/requests.h>
 #include <hardware/devices/io.h>
+#include <hardware/devices/serial.h>
+#include <hardware/memory/mmio.h>
+#include <hardware/memory/paging.h>
+#include <hardware/memory/pmm.h>
 
 #include <system/term.h>
 #include <system/flanterm.h>
 #include <system/flanterm_backends/fb.h>
 
 static struct flanterm_context *ft_ctx;
+static void *fb_base;
+static uint32_t *fb_shadow;
 
 void term_init() {
     struct limine_framebuffer_response *framebuffer_response = get_framebuffer();
@@ -30,6 +36,46 @@ void term_init() {
         0, 0,
         0
     );
+    fb_base = framebuffer->address;
+}
+
+/*
+ * Limine hands over the framebuffer through the HHDM, whose memory type we
+ * do not control. Once paging and PAT are set up, alias it write-combining
+ * in the MMIO window and move all console output over to that mapping.
+ * Reads from it are uncached (UC without PAT), so the console draws and
+ * scrolls in a RAM shadow and only ever writes the framebuffer.
+ */
+void term_map_framebuffer(void) {
+    struct limine_framebuffer *framebuffer = get_framebuffer()->framebuffers[0];
+    uintptr_t phys = phys_addr(framebuffer->address);
+    size_t size = framebuffer->pitch * framebuffer->height;
+
+    uintptr_t shadow = alloc_pages((size + PAGE_SIZE - 1) / PAGE_SIZE);
+    if (!shadow) {
+        printf("[ TERM ] No memory for a console shadow, staying on the boot mapping\n");
+        return;
+    }
+    fb_shadow = virt_addr(shadow);
+
+    fb_base = map_mmio_region(phys, size, MMIO_WC);
+    flanterm_fb_set_framebuffer(ft_ctx, fb_base, fb_shadow);
+    printf("[ TERM ] Framebuffer %#llx (%zu KiB) mapped WC at %p\n",
+           (unsigned long long)phys, size / 1024, fb_base);
+}
+
+void *term_framebuffer(void) {
+    return fb_base;
+}
+
+// The console's RAM copy of the screen, or NULL when it draws to the framebuffer directly
+uint32_t *term_console_pixels(void) {
+    return fb_shadow;
+}
+
+// Route changed console rows somewhere other than the framebuffer; needs the shadow
+void term_set_present(void (*present)(void *arg, size_t y0, size_t y1), void *arg) {
+    flanterm_fb_set_present(ft_ctx, present, arg);
 }
 
 void term_writeline(const char *s) {
@@ -41,9 +87,14 @@ void term_write(const char *s) {
     flanterm_write(ft_ctx, s, strlen(s));
 }
 
-void kputchar(char c) {
-    flanterm_write(ft_ctx, &c, 1);
+// Batched console sink: one flanterm pass and one serial burst per call
+void term_write_n(const char *s, size_t len) {
+    flanterm_write(ft_ctx, s, len);
 
     if (is_running_under_qemu(NULL))
-        IoWrite8(0x3F8, c);
+        serial_write(s, len);
+}
+
+void kputchar(char c) {
+    term_write_n(&c, 1);
 }
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <arch/x86_64/cpu.h>
+#include <arch/x86_64/apic/apic.h>
+
+#include <hardware/devices/io.h>
+#include <hardware/memory/pmm.h>
+#include <hardware/memory/paging.h>
+
+#include <system/time/vclock.h>
+
+#define CMOS_ADDRESS 0x70
+#define CMOS_DATA    0x71
+
+#define VCLOCK_SHIFT 32
+
+static VClockPage *vclock;
+static uintptr_t vclock_phys;
+
+static uint8_t cmos_read(uint8_t reg)
+{
+    IoWrite8(CMOS_ADDRESS, reg);
+    return IoRead8(CMOS_DATA);
+}
+
+static uint8_t bcd_to_bin(uint8_t v)
+{
+    return (v & 0x0F) + (v >> 4) * 10;
+}
+
+/* Days since 1970-01-01 for a proleptic Gregorian date */
+static uint64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return (uint64_t)(era * 146097 + (int64_t)doe - 719468);
+}
+
+static uint64_t rtc_read_unix_seconds(void)
+{
+    // Wait for any update cycle in progress to finish
+    while (cmos_read(0x0A) & 0x80)
+        __asm__ volatile("pause");
+
+    uint8_t sec   = cmos_read(0x00);
+    uint8_t min   = cmos_read(0x02);
+    uint8_t hour  = cmos_read(0x04);
+    uint8_t day   = cmos_read(0x07);
+    uint8_t month = cmos_read(0x08);
+    uint8_t year  = cmos_read(0x09);
+    uint8_t regb  = cmos_read(0x0B);
+
+    int pm = hour & 0x80;
+    hour &= 0x7F;
+
+    if (!(regb & 0x04)) {
+        sec   = bcd_to_bin(sec);
+        min   = bcd_to_bin(min);
+        hour  = bcd_to_bin(hour);
+        day   = bcd_to_bin(day);
+        month = bcd_to_bin(month);
+        year  = bcd_to_bin(year);
+    }
+    if (!(regb & 0x02) && pm)
+        hour = (hour % 12) + 12;
+
+    uint64_t days = days_from_civil(2000 + year, month, day);
+    return days * 86400ULL + hour * 3600ULL + min * 60ULL + sec;
+}
+
+static uint64_t vclock_delta_ns(uint64_t tsc)
+{
+    return (uint64_t)(((__uint128_t)(tsc - vclock->tsc_base) * vclock->tsc_mult) >> vclock->tsc_shift);
+}
+
+static void vclock_timer(void *unused)
+{
+    (void)unused;
+    vclock_update();
+    timer_register(VCLOCK_UPDATE_MS, vclock_timer, NULL);
+}
+
+void vclock_init(void)
+{
+    if (!frequency_tsc_per_sec) {
+        printf("[ VCLOCK ] TSC frequency unknown, clock page disabled\n");
+        return;
+    }
+
+    vclock_phys = alloc_page();
+    if (!vclock_phys) {
+        printf("[ VCLOCK ] Failed to allocate clock page\n");
+        return;
+    }
+    vclock = (VClockPage *)virt_addr(vclock_phys);
+    memset(vclock, 0, PAGE_SIZE);
+
+    vclock->version = VCLOCK_VERSION;
+    vclock->tsc_frequency = frequency_tsc_per_sec;
+    vclock->tsc_shift = VCLOCK_SHIFT;
+    vclock->tsc_mult = (1000000000ULL << VCLOCK_SHIFT) / frequency_tsc_per_sec;
+    vclock->wall_base_ns = rtc_read_unix_seconds() * 1000000000ULL;
+    vclock->mono_base_ns = 0;
+    vclock->tsc_base = rdtsc();
+
+    timer_register(VCLOCK_UPDATE_MS, vclock_timer, NULL);
+
+    printf("[ VCLOCK ] Clock page at %#llx, TSC %llu Hz\n",
+           (unsigned long long)VCLOCK_USER_ADDR, frequency_tsc_per_sec);
+}
+
+/*
+ * Re-anchors the bases to the current TSC so the (tsc - tsc_base) product
+ * stays small for readers. Readers retry while seq is odd or changed.
+ */
+void vclock_update(void)
+{
+    if (!vclock)
+        return;
+
+    uint64_t now = rdtsc();
+    uint64_t delta = vclock_delta_ns(now);
+
+    vclock->seq++;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    vclock->mono_base_ns += delta;
+    vclock->wall_base_ns += delta;
+    vclock->tsc_base = now;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    vclock->seq++;
+}
+
+void vclock_map_into(uint64_t pml4_phys)
+{
+    if (!vclock)
+        return;
+
+    mapPage_in_pml4(pml4_phys, (void *)VCLOCK_USER_ADDR, (void *)vclock_phys,
+                    PG_PRESENT | PG_USER | PG_NX);
+}
+
+static uint64_t vclock_read(int wall)
+{
+    if (!vclock)
+        return 0;
+
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = __atomic_load_n(&vclock->seq, __ATOMIC_ACQUIRE);
+        ns = (wall ? vclock->wall_base_ns : vclock->mono_base_ns) + vclock_delta_ns(rdtsc());
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != vclock->seq);
+
+    return ns;
+}
+
+uint64_t vclock_monotonic_ns(void)
+{
+    return vclock_read(0);
+}
+
+uint64_t vclock_realtime_ns(void)
+{
+    return vclock_read(1);
+}
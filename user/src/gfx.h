@@ -0,0 +1,45 @@
+#ifndef GFX_H
+#define GFX_H
+
+/*
+ * Userspace side of the compositor surfaces.
+ * Constants must match kernel/include/drivers/video/compositor.h.
+ */
+
+typedef unsigned int gfx_u32;
+
+#define SYS_GFX_MAP    503
+#define SYS_GFX_DAMAGE 504
+
+typedef struct GfxSurface {
+    gfx_u32 *pixels;    // 0 if mapping failed
+    gfx_u32  width;
+    gfx_u32  height;
+    gfx_u32  pitch;     // in pixels
+} GfxSurface;
+
+static inline long gfx_syscall(long n, long a1, long a2, long a3, long a4) {
+    long ret;
+    register long r10 __asm__("r10") = a4;
+    __asm__ volatile("syscall"
+                     : "=a"(ret)
+                     : "a"(n), "D"(a1), "S"(a2), "d"(a3), "r"(r10)
+                     : "rcx", "r11", "memory");
+    return ret;
+}
+
+/* Maps a width x height surface shown at (x, y) on screen */
+static inline GfxSurface gfx_map(int x, int y, gfx_u32 width, gfx_u32 height) {
+    GfxSurface s = { 0, width, height, width };
+    long addr = gfx_syscall(SYS_GFX_MAP, x, y, width, height);
+    if (addr >= 0)
+        s.pixels = (gfx_u32 *)addr;
+    return s;
+}
+
+/* Asks the compositor to present the changed region; no pixels are copied here */
+static inline long gfx_damage(gfx_u32 x, gfx_u32 y, gfx_u32 w, gfx_u32 h) {
+    return gfx_syscall(SYS_GFX_DAMAGE, x, y, w, h);
+}
+
+#endif // GFX_H
@@ -0,0 +1,108 @@
+#ifndef IORING_H
+#define IORING_H
+
+/*
+ * Userspace side of the kernel submission/completion rings.
+ * Layout must match kernel/include/system/io/ioring.h.
+ */
+
+typedef unsigned char      ioring_u8;
+typedef unsigned short     ioring_u16;
+typedef int                ioring_s32;
+typedef unsigned int       ioring_u32;
+typedef long long          ioring_s64;
+typedef unsigned long long ioring_u64;
+
+#define SYS_IORING_SETUP 425
+#define SYS_IORING_ENTER 426
+
+#define IORING_SETUP_SQPOLL (1u << 0)
+
+enum {
+    IORING_OP_NOP = 0,
+    IORING_OP_WRITE,
+    IORING_OP_TIMEOUT,
+};
+
+typedef struct IoRingSqe {
+    ioring_u8  opcode;
+    ioring_u8  flags;
+    ioring_u16 reserved;
+    ioring_s32 fd;
+    ioring_u64 addr;
+    ioring_u64 len;
+    ioring_u64 user_data;
+} IoRingSqe;
+
+typedef struct IoRingCqe {
+    ioring_u64 user_data;
+    ioring_s64 res;
+} IoRingCqe;
+
+typedef struct IoRingShared {
+    volatile ioring_u32 sq_head;
+    volatile ioring_u32 sq_tail;
+    volatile ioring_u32 cq_head;
+    volatile ioring_u32 cq_tail;
+    ioring_u32 sq_entries;
+    ioring_u32 cq_entries;
+    ioring_u32 flags;
+    ioring_u32 sqes_offset;
+    ioring_u32 cqes_offset;
+    volatile ioring_u32 cq_overflow;
+} IoRingShared;
+
+static inline long ioring_syscall(long n, long a1, long a2) {
+    long ret;
+    __asm__ volatile("syscall"
+                     : "=a"(ret)
+                     : "a"(n), "D"(a1), "S"(a2)
+                     : "rcx", "r11", "memory");
+    return ret;
+}
+
+/* Returns the shared ring header, or 0 on failure */
+static inline IoRingShared *ioring_setup(unsigned entries, unsigned flags) {
+    long addr = ioring_syscall(SYS_IORING_SETUP, entries, flags);
+    return addr < 0 ? 0 : (IoRingShared *)addr;
+}
+
+static inline IoRingSqe *ioring_sqes(IoRingShared *r) {
+    return (IoRingSqe *)((char *)r + r->sqes_offset);
+}
+
+static inline IoRingCqe *ioring_cqes(IoRingShared *r) {
+    return (IoRingCqe *)((char *)r + r->cqes_offset);
+}
+
+/* Next free SQE, or 0 if the submission ring is full */
+static inline IoRingSqe *ioring_get_sqe(IoRingShared *r) {
+    ioring_u32 head = __atomic_load_n(&r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_tail - head >= r->sq_entries)
+        return 0;
+    IoRingSqe *sqe = &ioring_sqes(r)[r->sq_tail & (r->sq_entries - 1)];
+    sqe->flags = 0;
+    sqe->reserved = 0;
+    return sqe;
+}
+
+/* Publishes the SQE returned by the last ioring_get_sqe() */
+static inline void ioring_queue(IoRingShared *r) {
+    __atomic_store_n(&r->sq_tail, r->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline long ioring_enter(unsigned to_submit, unsigned min_complete) {
+    return ioring_syscall(SYS_IORING_ENTER, to_submit, min_complete);
+}
+
+/* Pops one completion; returns 0 if none is ready */
+static inline int ioring_reap(IoRingShared *r, IoRingCqe *out) {
+    ioring_u32 tail = __atomic_load_n(&r->cq_tail, __ATOMIC_ACQUIRE);
+    if (r->cq_head == tail)
+        return 0;
+    *out = ioring_cqes(r)[r->cq_head & (r->cq_entries - 1)];
+    __atomic_store_n(&r->cq_head, r->cq_head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#endif // IORING_H
@@ -0,0 +1,57 @@
+#ifndef VCLOCK_H
+#define VCLOCK_H
+
+/*
+ * Syscall-free clock reads. The kernel maps a read-only page at
+ * VCLOCK_USER_ADDR into every process and keeps it anchored to the TSC;
+ * layout must match kernel/include/system/time/vclock.h.
+ */
+
+typedef unsigned int vclock_u32;
+typedef unsigned long long vclock_u64;
+
+#define VCLOCK_USER_ADDR 0x0000000040010000ULL
+
+typedef struct VClockPage {
+    volatile vclock_u32 seq;
+    vclock_u32 version;
+    vclock_u64 tsc_base;
+    vclock_u64 mono_base_ns;
+    vclock_u64 wall_base_ns;
+    vclock_u64 tsc_mult;
+    vclock_u32 tsc_shift;
+    vclock_u32 reserved;
+    vclock_u64 tsc_frequency;
+} VClockPage;
+
+static inline vclock_u64 vclock_rdtsc(void) {
+    vclock_u32 lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((vclock_u64)hi << 32) | lo;
+}
+
+static inline vclock_u64 vclock_read(int wall) {
+    const VClockPage *vc = (const VClockPage *)VCLOCK_USER_ADDR;
+    vclock_u32 seq;
+    vclock_u64 ns;
+    do {
+        seq = __atomic_load_n(&vc->seq, __ATOMIC_ACQUIRE);
+        vclock_u64 delta = vclock_rdtsc() - vc->tsc_base;
+        ns = (wall ? vc->wall_base_ns : vc->mono_base_ns)
+           + (vclock_u64)(((unsigned __int128)delta * vc->tsc_mult) >> vc->tsc_shift);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != vc->seq);
+    return ns;
+}
+
+/* Nanoseconds since boot */
+static inline vclock_u64 vclock_monotonic_ns(void) {
+    return vclock_read(0);
+}
+
+/* Nanoseconds since the Unix epoch */
+static inline vclock_u64 vclock_realtime_ns(void) {
+    return vclock_read(1);
+}
+
+#endif // VCLOCK_H